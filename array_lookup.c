@@ -1,3 +1,4 @@
+#include <sys/stat.h>
 #include "array_lookup.h"
 
 void exit_mem_fail(void) {
@@ -15,6 +16,11 @@ void exit_dup_key(char *s) {
    exit(EXIT_FAILURE);
 }
 
+void exit_long_key(char *s) {
+   fprintf(stderr, "key '%.64s...' is too long\n", s);
+   exit(EXIT_FAILURE);
+}
+
 int cmp(const void *a, const void *b) {
    const char **ia = (const char **) a;
    const char **ib = (const char **) b;
@@ -22,30 +28,192 @@ int cmp(const void *a, const void *b) {
 }
 
 
-array_lookup finalize_array_lookup(array_lookup lookup, const char c) {
-// Sort items in alphabetical order and assign 'values' pointers.
-// The first occurence of 'c' is replaced by '\0' and the pointer in
-// 'values' is assigned to the next character. Pointers in 'keys' and
-// 'values' at the same index point to different positions of the same
-// string.
+static size_t put_varint(char *p, size_t n) {
+// Write 'n' 7 bits at a time, high bit set on all bytes but the last.
+// Return the number of bytes written.
+
+   size_t i = 0;
+   while (n >= 0x80) {
+      p[i++] = (char) (n | 0x80);
+      n >>= 7;
+   }
+   p[i++] = (char) n;
+   return i;
+
+}
+
+static size_t varint_size(size_t n) {
+// Number of bytes 'put_varint()' writes for 'n'.
+   size_t i;
+   for (i = 1 ; n >= 0x80 ; i++) n >>= 7;
+   return i;
+}
+
+static size_t shared_prefix(const char *a, const char *b, size_t len) {
+// Length of the prefix shared by 'a' and 'b' (at most 'len').
+   size_t i;
+   for (i = 0 ; i < len && a[i] == b[i] ; i++);
+   return i;
+}
+
+static size_t get_varint(const char **p) {
+
+   size_t n = 0;
+   int shift = 0;
+   const unsigned char *q = (const unsigned char *) *p;
+   while (*q & 0x80) {
+      n |= (size_t) (*q++ & 0x7f) << shift;
+      shift += 7;
+   }
+   n |= (size_t) *q++ << shift;
+   *p = (const char *) q;
+   return n;
+
+}
+
+
+typedef
+struct
+/*********************************************************************
+  Interned value pool used during construction.
+    'slots': open addressing table of offsets in 'pool' (+1, 0 = empty)
+    'size' : number of slots (a power of 2)
+    'used' : number of distinct values
+*********************************************************************/
+{
+   uint32_t   *slots;
+   size_t      size;
+   size_t      used;
+   char       *pool;
+   size_t      len;
+   size_t      cap;
+}
+value_pool;
+
+
+static size_t hash_value(const char *s) {
+// FNV-1a.
+   size_t h = 14695981039346656037ULL;
+   while (*s) h = (h ^ (unsigned char) *s++) * 1099511628211ULL;
+   return h;
+}
+
+
+static uint32_t intern(value_pool *vp, const char *s) {
+// Return the offset of 's' in the pool, adding it if needed.
+
+   size_t i;
+
+   if (2 * (vp->used + 1) > vp->size) {
+      // Rehash in a table twice as large.
+      size_t size = vp->size == 0 ? 1024 : 2 * vp->size;
+      uint32_t *slots = (uint32_t *) calloc(size, sizeof(uint32_t));
+      if (slots == NULL) exit_mem_fail();
+      for (i = 0 ; i < vp->size ; i++) {
+         if (vp->slots[i] == 0) continue;
+         size_t j = hash_value(vp->pool + vp->slots[i] - 1) & (size-1);
+         while (slots[j] != 0) j = (j+1) & (size-1);
+         slots[j] = vp->slots[i];
+      }
+      free(vp->slots);
+      vp->slots = slots;
+      vp->size = size;
+   }
+
+   for (i = hash_value(s) & (vp->size-1) ; vp->slots[i] != 0 ;
+         i = (i+1) & (vp->size-1)) {
+      if (strcmp(vp->pool + vp->slots[i] - 1, s) == 0) {
+         return vp->slots[i] - 1;
+      }
+   }
+
+   size_t len = strlen(s) + 1;
+   if (vp->len + len >= UINT32_MAX) {
+      fprintf(stderr, "values larger than 4 GB\n");
+      exit(EXIT_FAILURE);
+   }
+   if (vp->len + len > vp->cap) {
+      vp->cap = 2 * (vp->len + len);
+      vp->pool = (char *) realloc(vp->pool, vp->cap * sizeof(char));
+      if (vp->pool == NULL) exit_mem_fail();
+   }
+   memcpy(vp->pool + vp->len, s, len);
+   vp->slots[i] = vp->len + 1;
+   vp->used++;
+   vp->len += len;
+
+   return vp->slots[i] - 1;
+
+}
+
+
+array_lookup finalize_array_lookup(char **lines, int item_nb,
+      const char c) {
+// Sort lines in alphabetical order and split them on the first
+// occurence of 'c' (replaced by '\0'). Keys are front-coded and values
+// interned in a pool. The lines are not needed after the call. Only
+// the exact size of every part is allocated, the lines are the peak.
 
    // Sort items in place.
-   qsort(lookup.keys, lookup.item_nb, sizeof(char *), cmp);
+   qsort(lines, item_nb, sizeof(char *), cmp);
 
    int i, j;
 
-   // Iterate over 'keys' array.
-   for (i = 0 ; lookup.keys[i] != NULL ; i++) {
-      for (j = 0 ; lookup.keys[i][j] != c ; j++)
-         if (lookup.keys[i][j] == '\0') exit_no_sep(lookup.keys[i]);
-      lookup.keys[i][j] = '\0';
-      lookup.values[i] = lookup.keys[i] + j+1;
+   array_lookup lookup = {
+      .item_nb = item_nb,
+      .keys    = NULL,
+      .blocks  = (size_t *) malloc((item_nb / LOOKUP_BLOCK + 1) *
+                  sizeof(size_t)),
+      .values  = (uint32_t *) malloc((item_nb+1) * sizeof(uint32_t)),
+      .pool    = NULL,
+   };
+   if (lookup.blocks == NULL || lookup.values == NULL) exit_mem_fail();
+
+   // Split, check key duplication and intern the values.
+   value_pool vp = { .slots = NULL, .size = 0, .used = 0,
+      .pool = NULL, .len = 0, .cap = 0 };
+   for (i = 0 ; i < item_nb ; i++) {
+      for (j = 0 ; lines[i][j] != c ; j++)
+         if (lines[i][j] == '\0') exit_no_sep(lines[i]);
+      if (j >= LOOKUP_MAX_KEY) exit_long_key(lines[i]);
+      lines[i][j] = '\0';
+      lookup.values[i] = intern(&vp, lines[i] + j+1);
+      if (i > 0 && strcmp(lines[i-1], lines[i]) == 0)
+         exit_dup_key(lines[i]);
    }
+   free(vp.slots);
+   lookup.pool = (char *) realloc(vp.pool, vp.len + 1);
+   if (lookup.pool == NULL) exit_mem_fail();
 
-   // Check key duplication.
-   for (i = 0 ; i < lookup.item_nb-1 ; i++) {
-      if (strcmp(lookup.keys[i], lookup.keys[i+1]) == 0)
-         exit_dup_key(lookup.keys[i]);
+   // Front-code the keys in a block of the exact size.
+   size_t pos = 0;
+   size_t len;
+   size_t shared;
+   for (i = 0 ; i < item_nb ; i++) {
+      len = strlen(lines[i]);
+      shared = i % LOOKUP_BLOCK == 0 ? 0 : shared_prefix(lines[i-1],
+            lines[i], len);
+      if (i % LOOKUP_BLOCK != 0) pos += varint_size(shared);
+      pos += varint_size(len - shared) + len - shared;
+   }
+   lookup.keys = (char *) malloc(pos + 1);
+   if (lookup.keys == NULL) exit_mem_fail();
+
+   pos = 0;
+   for (i = 0 ; i < item_nb ; i++) {
+      len = strlen(lines[i]);
+      if (i % LOOKUP_BLOCK == 0) {
+         lookup.blocks[i / LOOKUP_BLOCK] = pos;
+         shared = 0;
+         pos += put_varint(lookup.keys + pos, len);
+      }
+      else {
+         shared = shared_prefix(lines[i-1], lines[i], len);
+         pos += put_varint(lookup.keys + pos, shared);
+         pos += put_varint(lookup.keys + pos, len - shared);
+      }
+      memcpy(lookup.keys + pos, lines[i] + shared, len - shared);
+      pos += len - shared;
    }
 
    return lookup;
@@ -54,65 +222,109 @@ array_lookup finalize_array_lookup(array_lookup lookup, const char c) {
 
 array_lookup generate_array_lookup_from_file (FILE *f) {
 
-   char iob[IO_BUFFER_SIZE];
-   int item_nb = 0;
+   size_t size = IO_BUFFER_SIZE;
+   size_t len = 0;
+   struct stat st;
+
+   // Read the whole file in one block (no allocation per line), of
+   // the size of the file if it is known, so that it is not grown.
+   if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode)) {
+      size = st.st_size + 2;
+   }
+   char *text = (char *) malloc(size * sizeof(char));
+   if (text == NULL) exit_mem_fail();
 
-   // Count lines. Hope to hit '\n' on every call to 'fgets'.
-   // If not, overestimate 'item_nb' and assign too much memory.
    rewind(f);
-   while(fgets(iob, IO_BUFFER_SIZE, f) != NULL) item_nb++;
+   while (1) {
+      len += fread(text + len, 1, size - len - 1, f);
+      if (feof(f) || ferror(f)) break;
+      size *= 2;
+      text = (char *) realloc(text, size * sizeof(char));
+      if (text == NULL) exit_mem_fail();
+   }
+   text[len] = '\0';
+
+   // Count lines (the last one may have no '\n').
+   size_t i;
+   int item_nb = 0;
+   for (i = 0 ; i < len ; i++) item_nb += text[i] == '\n';
+   if (len > 0 && text[len-1] != '\n') item_nb++;
 
-   // Allocate array memory (keep one slot for sentinel).
-   char **keys = (char **) malloc((item_nb+1) * sizeof(char *));
-   char **values = (char **) malloc((item_nb+1) * sizeof(char *));
+   char **lines = (char **) malloc((item_nb+1) * sizeof(char *));
+   if (lines == NULL) exit_mem_fail();
 
-   if ((keys == NULL) || (values == NULL)) exit_mem_fail();
+   // Chomp lines in place.
+   int n = 0;
+   char *line = text;
+   for (i = 0 ; i < len ; i++) {
+      if (text[i] != '\n') continue;
+      text[i] = '\0';
+      lines[n++] = line;
+      line = text + i + 1;
+   }
+   if (n < item_nb) lines[n++] = line;
 
-   int len, i = 0;
+   array_lookup lookup = finalize_array_lookup(lines, item_nb, '\t');
 
-   // Read file one more time and copy lines to 'keys' array.
-   rewind(f);
-   while (fgets(iob, IO_BUFFER_SIZE, f) != NULL) {
+   free(lines);
+   free(text);
 
-      len = strlen(iob);
-      // Chomp (replace '\n' by '\0').
-      if (iob[len-1] == '\n') iob[--len] = '\0';
-      // Allocate data memory.
-      char *temp = (char *) malloc((len+1) * sizeof(char));
+   return lookup;
 
-      if (temp == NULL) exit_mem_fail();
+}
 
-      strcpy(temp, iob);
-      keys[i++] = temp;
+void lookup_key(const array_lookup *lookup, int i, char *key) {
+// Decode key 'i' in 'key', which must hold 'LOOKUP_MAX_KEY' chars.
 
+   const char *p = lookup->keys + lookup->blocks[i / LOOKUP_BLOCK];
+   size_t len = get_varint(&p);
+   size_t shared;
+   int j;
+
+   memcpy(key, p, len);
+   p += len;
+
+   for (j = 0 ; j < i % LOOKUP_BLOCK ; j++) {
+      shared = get_varint(&p);
+      len = get_varint(&p);
+      memcpy(key + shared, p, len);
+      p += len;
+      len += shared;
    }
 
-   // Add sentinels.
-   keys[i] = NULL;
-   values[i] = NULL;
+   key[len] = '\0';
 
-   array_lookup lookup = { 
-      .item_nb  = item_nb,
-      .keys    = keys, 
-      .values  = values,
-   };
-   
-   return finalize_array_lookup(lookup, '\t');
+}
 
+char *lookup_value(const array_lookup *lookup, int i) {
+   return lookup->pool + lookup->values[i];
 }
 
-void dealloc_array_lookup(array_lookup *lookup) {
+void dealloc_array_lookup_keys(array_lookup *lookup) {
+// Free the keys but keep the values in 'pool' (tries point to them).
 
-   int i;
-   for (i = 0 ; i < lookup->item_nb + 1 ; i++) {
-      free(lookup->keys[i]);
-   }
    free(lookup->keys);
+   free(lookup->blocks);
    free(lookup->values);
 
    lookup->item_nb = 0;
    lookup->keys = NULL;
+   lookup->blocks = NULL;
    lookup->values = NULL;
 
 }
 
+void dealloc_array_lookup(array_lookup *lookup) {
+
+   free(lookup->keys);
+   free(lookup->blocks);
+   free(lookup->values);
+   free(lookup->pool);
+
+   lookup->item_nb = 0;
+   lookup->keys = NULL;
+   lookup->blocks = NULL;
+   lookup->values = NULL;
+   lookup->pool = NULL;
+
+}
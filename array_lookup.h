@@ -1,30 +1,46 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+
+#ifndef _ARRAY_LOOKUP_H
+#define _ARRAY_LOOKUP_H
 
 #define IO_BUFFER_SIZE 65536
+#define LOOKUP_MAX_KEY 65536
+#define LOOKUP_BLOCK 16
 
 typedef
 struct
 /*********************************************************************
-  Lookup of 'char' arrays with the following attributes.              
-    'item_nb': number of items in the lookup                          
-    'keys'   : array of key strings                                   
-    'values' : array of value strings                                 
-                                                                      
-  For a given index 'i', 'keys[i]' and values[i]' point to different  
-  positions of the same 'char' array, separated by '\0'.              
-                                                                      
+  Lookup of 'char' arrays with the following attributes.
+    'item_nb': number of items in the lookup
+    'keys'   : front-coded keys, in blocks of 'LOOKUP_BLOCK'
+    'blocks' : offset of every block in 'keys'
+    'values' : offset of the value of every item in 'pool'
+    'pool'   : distinct values, separated by '\0'
+
+  Keys are sorted, so consecutive keys share long prefixes. The first
+  key of a block is stored in full (length, characters), the others
+  as the length of the prefix shared with the previous key, the length
+  of the suffix and the suffix (lengths are varints). Identical values
+  are stored once in 'pool'.
+
 *********************************************************************/
 {
-   int    item_nb;
-   char   **keys;
-   char   **values;
+   int        item_nb;
+   char      *keys;
+   size_t    *blocks;
+   uint32_t  *values;
+   char      *pool;
 }
 array_lookup;
 
 
 array_lookup generate_array_lookup_from_file (FILE *);
+void lookup_key(const array_lookup *, int, char *);
+char *lookup_value(const array_lookup *, int);
+void dealloc_array_lookup_keys(array_lookup *);
 void dealloc_array_lookup(array_lookup *);
 
-
+#endif
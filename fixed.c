@@ -0,0 +1,211 @@
+#include "fixed.h"
+
+/*
+Keys of a single length. Leftmost-longest matching reduces to finding
+the first window of 'klen' characters that is a key, so the windows
+are hashed with a rolling hash and looked up in an open addressing
+table, at a constant cost per character whatever the depth of the
+trie. Keys over 'ACGT' of at most 32 bases are packed 2 bits a base,
+the packed window is then its own hash. Every hit is verified against
+the key before it is reported.
+*/
+
+#define BASE 1099511628211ULL
+#define GOLDEN 0x9E3779B97F4A7C15ULL
+
+// Base code + 1, 0 for characters that are not a base.
+static const unsigned char PACK[256] = {
+   ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4,
+};
+
+
+typedef
+struct
+/*********************************************************************
+  State of the walk over the keys in 'fixed_build()'.
+    't' : table, with its arrays allocated in the second walk
+    'n' : number of keys visited so far
+*********************************************************************/
+{
+   fixed_table   *t;
+   size_t         n;
+}
+fixed_walk;
+
+
+static int collect_tail(rt_node *tail, const char *key, size_t len,
+      void *arg) {
+// Count the key, or copy it to the table if its arrays are allocated.
+// Return 0 if the keys do not all have the same length, 1 otherwise.
+
+   fixed_walk *w = (fixed_walk *) arg;
+   fixed_table *t = w->t;
+
+   if (w->n == 0) t->klen = len;
+   if (len != t->klen) return 0;
+   if (t->keys != NULL) {
+      memcpy(t->keys + w->n * t->klen, key, t->klen);
+      t->tails[w->n] = tail;
+   }
+   w->n++;
+
+   return 1;
+
+}
+
+
+static uint64_t hash_key(const fixed_table *t, const char *s) {
+
+   uint64_t h = 0;
+   size_t j;
+   for (j = 0 ; j < t->klen ; j++) {
+      if (t->packed) h = (h << 2) | (PACK[(unsigned char) s[j]] - 1);
+      else h = h * BASE + (unsigned char) s[j];
+   }
+   return h;
+
+}
+
+
+static inline rt_node *lookup(const fixed_table *t, uint64_t h,
+      const char *s) {
+// Return the tail node of key 's' with hash 'h', NULL if not a key.
+
+   const size_t mask = ((size_t) 1 << t->bits) - 1;
+   size_t i;
+
+   for (i = (h * GOLDEN) >> (64 - t->bits) ; t->ids[i] != 0 ;
+         i = (i+1) & mask) {
+      if (t->hashes[i] != h) continue;
+      const size_t id = t->ids[i] - 1;
+      if (memcmp(t->keys + id * t->klen, s, t->klen) == 0) {
+         return t->tails[id];
+      }
+   }
+
+   return NULL;
+
+}
+
+
+fixed_table *fixed_build(rt_node *root) {
+// Build the hash table of the keys of the trie. Return 'NULL' if the
+// keys do not all have the same length (the trie is then used).
+
+   fixed_table *t = (fixed_table *) calloc(1, sizeof(fixed_table));
+   if (t == NULL) goto fail;
+
+   fixed_walk w = { t, 0 };
+   if (!rt_walk_keys(root, collect_tail, &w)) goto fail;
+   size_t n = w.n;
+   if (n == 0 || n >= UINT32_MAX) goto fail;
+
+   for (t->bits = 4 ; ((size_t) 1 << t->bits) < 2 * n ; t->bits++);
+   t->hashes = (uint64_t *) malloc(sizeof(uint64_t) << t->bits);
+   t->ids = (uint32_t *) calloc((size_t) 1 << t->bits, sizeof(uint32_t));
+   t->keys = (char *) malloc(n * t->klen * sizeof(char));
+   t->tails = (rt_node **) malloc(n * sizeof(rt_node *));
+   if (t->hashes == NULL || t->ids == NULL || t->keys == NULL ||
+         t->tails == NULL) goto fail;
+
+   w.n = 0;
+   if (!rt_walk_keys(root, collect_tail, &w)) goto fail;
+
+   size_t i, j;
+   t->packed = t->klen <= 32;
+   for (j = 0 ; t->packed && j < n * t->klen ; j++) {
+      t->packed = PACK[(unsigned char) t->keys[j]] != 0;
+   }
+
+   t->power = 1;
+   for (j = 1 ; j < t->klen ; j++) t->power *= BASE;
+
+   const size_t mask = ((size_t) 1 << t->bits) - 1;
+   for (i = 0 ; i < n ; i++) {
+      uint64_t h = hash_key(t, t->keys + i * t->klen);
+      for (j = (h * GOLDEN) >> (64 - t->bits) ; t->ids[j] != 0 ;
+            j = (j+1) & mask);
+      t->hashes[j] = h;
+      t->ids[j] = i + 1;
+   }
+
+   return t;
+
+fail:
+   fixed_free(t);
+   return NULL;
+
+}
+
+
+rt_node *fixed_next(const fixed_table *t, const char *buf, size_t len,
+      rt_node *root, size_t *pos, int *more) {
+// Return the tail node of the first key found in 'buf' at or after
+// '*pos' and set '*pos' to its position. If there is none, return
+// 'NULL' and set '*pos' to 'len', or to the first position where a key
+// of the trie 'root' could start and end beyond the buffer, in which
+// case set '*more'.
+
+   const size_t klen = t->klen;
+   rt_node *tail;
+   size_t j;
+
+   *more = 0;
+
+   if (t->packed) {
+      // Restart the window after characters that are not bases.
+      const uint64_t mask = klen == 32 ? ~0ULL : (1ULL << 2*klen) - 1;
+      uint64_t code = 0;
+      size_t filled = 0;
+      for (j = *pos ; j < len ; j++) {
+         const int b = PACK[(unsigned char) buf[j]];
+         if (b == 0) {
+            filled = 0;
+            continue;
+         }
+         code = ((code << 2) | (b-1)) & mask;
+         if (++filled < klen) continue;
+         tail = lookup(t, code, buf + j+1 - klen);
+         if (tail != NULL) {
+            *pos = j+1 - klen;
+            return tail;
+         }
+      }
+   }
+   else if (len - *pos >= klen) {
+      uint64_t h = 0;
+      for (j = *pos ; j < *pos + klen ; j++) {
+         h = h * BASE + (unsigned char) buf[j];
+      }
+      for (j = *pos ; ; j++) {
+         tail = lookup(t, h, buf + j);
+         if (tail != NULL) {
+            *pos = j;
+            return tail;
+         }
+         if (j + klen >= len) break;
+         h = (h - (unsigned char) buf[j] * t->power) * BASE +
+            (unsigned char) buf[j+klen];
+      }
+   }
+
+   // Windows that end beyond the buffer are searched in the trie: only
+   // the positions where a key may start are undecided.
+   size_t match_len;
+   size_t start = len >= klen ? len - klen + 1 : 0;
+   if (start > *pos) *pos = start;
+   return rt_match_from(buf, len, root, pos, &match_len, more);
+
+}
+
+
+void fixed_free(fixed_table *t) {
+
+   if (t == NULL) return;
+   free(t->hashes);
+   free(t->ids);
+   free(t->keys);
+   free(t->tails);
+   free(t);
+
+}
@@ -0,0 +1,41 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "radixtrie.h"
+
+#ifndef _FIXED_H
+#define _FIXED_H
+
+typedef
+struct
+/*********************************************************************
+  Hash table of a key set where all the keys have the same length.
+    'klen'  : length of the keys
+    'packed': keys over 'ACGT' of at most 32 bases, hashed 2 bits a base
+    'bits'  : log2 of the number of slots
+    'hashes': hash of the key in every slot
+    'ids'   : index of the key in 'keys' and 'tails' + 1, 0 if empty
+    'keys'  : the keys, 'klen' characters each, for verification
+    'tails' : tail nodes of the keys in the trie (value and key id)
+    'power' : multiplier of the leaving character in the rolling hash
+*********************************************************************/
+{
+   size_t      klen;
+   int         packed;
+   int         bits;
+   uint64_t   *hashes;
+   uint32_t   *ids;
+   char       *keys;
+   rt_node   **tails;
+   uint64_t    power;
+}
+fixed_table;
+
+
+fixed_table *fixed_build(rt_node *);
+rt_node *fixed_next(const fixed_table *, const char *, size_t, rt_node *,
+      size_t *, int *);
+void fixed_free(fixed_table *);
+
+#endif
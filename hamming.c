@@ -0,0 +1,297 @@
+#include "hamming.h"
+
+/*
+Approximate keys. A key matches the input at a position if they differ
+by at most 'max_mismatches' substitutions (Hamming distance). Among
+the keys that match at a position, the one with the fewest mismatches
+wins, then the longest one as usual. If several keys are tied on both,
+the hit is ambiguous and nothing matches at this position. Keys never
+match across a newline, even with a mismatch to spare.
+*/
+
+static int max_mismatches = 0;
+
+typedef
+struct
+/*********************************************************************
+  Best match found so far by the search.
+    'node' : tail node of the best key, 'NULL' if none yet
+    'len'  : length of the best key
+    'dist' : number of mismatches of the best key
+    'ties' : number of other keys with the same length and distance
+*********************************************************************/
+{
+   rt_node   *node;
+   size_t     len;
+   int        dist;
+   int        ties;
+}
+hm_best;
+
+
+void rt_set_mismatches(int d) {
+   max_mismatches = d;
+}
+
+
+static void match_hamming(const char *buf, size_t len, rt_node *parent,
+      size_t pos, int dist, hm_best *best, int *more) {
+// Depth-first search of all the paths within the mismatch budget.
+// Mismatches only add up down a path, so a branch stops as soon as
+// it has more mismatches than the best key found so far.
+
+   rt_node *child;
+   int i, j, d;
+
+   for (i = 0 ; (child = parent->children[i]) != NULL ; i++) {
+      d = dist;
+      for (j = 0 ; child->subkey[j] != '\0' ; j++) {
+         if (pos + j >= len) {
+            *more = 1;
+            break;
+         }
+         if (buf[pos+j] == child->subkey[j]) continue;
+         if (buf[pos+j] == '\n' || ++d > max_mismatches) break;
+         if (best->node != NULL && d > best->dist) break;
+      }
+      if (child->subkey[j] != '\0') continue;
+      if (child->data != NULL) {
+         if (best->node == NULL || d < best->dist ||
+               (d == best->dist && pos + j > best->len)) {
+            best->node = child;
+            best->len = pos + j;
+            best->dist = d;
+            best->ties = 0;
+         }
+         else if (d == best->dist && pos + j == best->len) {
+            best->ties++;
+         }
+      }
+      match_hamming(buf, len, child, pos + j, d, best, more);
+   }
+
+}
+
+
+rt_node *rt_match_hamming(const char *buf, size_t len, rt_node *root,
+      size_t *match_len, int *more) {
+// Same as 'rt_match_buf()' with up to 'max_mismatches' substitutions.
+// Return 'NULL' if the closest keys are tied.
+
+   hm_best best = { .node = NULL, .len = 0, .dist = 0, .ties = 0 };
+   int dummy;
+
+   *match_len = 0;
+   if (more == NULL) more = &dummy;
+   *more = 0;
+
+   match_hamming(buf, len, root, 0, 0, &best, more);
+   if (best.node == NULL || best.ties > 0) return NULL;
+
+   *match_len = best.len;
+   return best.node;
+
+}
+
+
+
+static uint64_t hash_segment(const char *s, size_t len, int probe) {
+// FNV-1a, seeded with the probe so that segments at different
+// positions do not collide.
+
+   uint64_t h = 14695981039346656037ULL ^ (uint64_t) probe;
+   size_t j;
+   for (j = 0 ; j < len ; j++) {
+      h = (h ^ (unsigned char) s[j]) * 1099511628211ULL;
+   }
+   return h;
+
+}
+
+
+static int probe_index(hm_index *x, size_t offset, size_t len) {
+// Index of the probe at 'offset' of length 'len', added if needed.
+// Return -1 if there are too many probes.
+
+   int j;
+   for (j = 0 ; j < x->nprobes ; j++) {
+      if (x->offsets[j] == offset && x->lengths[j] == len) return j;
+   }
+   if (x->nprobes == MAX_PROBES) return -1;
+   x->offsets[x->nprobes] = offset;
+   x->lengths[x->nprobes] = len;
+   return x->nprobes++;
+
+}
+
+
+typedef
+struct
+/*********************************************************************
+  State of the walk over the keys in 'hm_build_index()'.
+    'x'     : index, with its key arrays allocated in the second walk
+    'd'     : number of mismatches to index for
+    'n'     : number of keys visited so far
+    'bytes' : number of characters of these keys
+*********************************************************************/
+{
+   hm_index   *x;
+   int         d;
+   size_t      n;
+   size_t      bytes;
+}
+hm_walk;
+
+
+static int add_key_probes(rt_node *tail, const char *key, size_t len,
+      void *arg) {
+// Set the probes of the key. Count it, or copy it if 'keys' is
+// allocated. Return 0 if the key cannot be indexed.
+
+   hm_walk *w = (hm_walk *) arg;
+   hm_index *x = w->x;
+   const int d = w->d;
+
+   // A key of at most 'd' characters matches everywhere.
+   if (len <= (size_t) d) return 0;
+   if (len > x->span) x->span = len;
+   int j;
+   for (j = 0 ; j <= d ; j++) {
+      size_t offset = j * len / (d+1);
+      if (probe_index(x, offset, (j+1) * len / (d+1) - offset) < 0) {
+         return 0;
+      }
+   }
+   if (x->keys != NULL) {
+      memcpy(x->keys + w->bytes, key, len);
+      x->starts[w->n] = w->bytes;
+      x->tails[w->n] = tail;
+   }
+   w->n++;
+   w->bytes += len;
+
+   return 1;
+
+}
+
+
+hm_index *hm_build_index(rt_node *root, int d) {
+// Index the segments of the keys of the trie for up to 'd' mismatches.
+// Return 'NULL' if the keys cannot be indexed (keys of at most 'd'
+// characters or too many key lengths): the trie is then searched at
+// every position.
+
+   hm_index *x = (hm_index *) calloc(1, sizeof(hm_index));
+   if (x == NULL) goto fail;
+
+   hm_walk w = { x, d, 0, 0 };
+   if (!rt_walk_keys(root, add_key_probes, &w)) goto fail;
+   size_t n = w.n;
+   size_t bytes = w.bytes;
+   if (n == 0 || (d+1) * n >= UINT32_MAX) goto fail;
+
+   for (x->bits = 4 ; ((size_t) 1 << x->bits) < 2 * (d+1) * n ; x->bits++);
+   x->hashes = (uint64_t *) malloc(sizeof(uint64_t) << x->bits);
+   x->ids = (uint32_t *) calloc((size_t) 1 << x->bits, sizeof(uint32_t));
+   x->keys = (char *) malloc(bytes + 1);
+   x->starts = (size_t *) malloc((n+1) * sizeof(size_t));
+   x->tails = (rt_node **) malloc(n * sizeof(rt_node *));
+   if (x->hashes == NULL || x->ids == NULL || x->keys == NULL ||
+         x->starts == NULL || x->tails == NULL) goto fail;
+
+   w.n = w.bytes = 0;
+   if (!rt_walk_keys(root, add_key_probes, &w)) goto fail;
+   x->starts[n] = bytes;
+
+   // One entry per segment of every key.
+   const size_t mask = ((size_t) 1 << x->bits) - 1;
+   size_t i, k;
+   int j;
+   for (k = 0 ; k < n ; k++) {
+      const size_t len = x->starts[k+1] - x->starts[k];
+      for (j = 0 ; j <= d ; j++) {
+         size_t offset = j * len / (d+1);
+         size_t seglen = (j+1) * len / (d+1) - offset;
+         int probe = probe_index(x, offset, seglen);
+         uint64_t h = hash_segment(x->keys + x->starts[k] + offset, seglen,
+               probe);
+         for (i = h & mask ; x->ids[i] != 0 ; i = (i+1) & mask);
+         x->hashes[i] = h;
+         x->ids[i] = k + 1;
+      }
+   }
+
+   return x;
+
+fail:
+   hm_free_index(x);
+   return NULL;
+
+}
+
+
+rt_node *hm_match(const hm_index *x, const char *buf, size_t len,
+      rt_node *root, size_t *match_len, int *more) {
+// Same as 'rt_match_hamming()', but only the keys with a segment that
+// matches exactly are compared with the input. Positions closer to the
+// end of the buffer than the longest key are searched in the trie, so
+// that '*more' tells if the match is decided.
+
+   if (len < x->span) {
+      return rt_match_hamming(buf, len, root, match_len, more);
+   }
+
+   hm_best best = { .node = NULL, .len = 0, .dist = 0, .ties = 0 };
+   const size_t mask = ((size_t) 1 << x->bits) - 1;
+   size_t i, k;
+   int j;
+
+   for (j = 0 ; j < x->nprobes ; j++) {
+      uint64_t h = hash_segment(buf + x->offsets[j], x->lengths[j], j);
+      for (i = h & mask ; x->ids[i] != 0 ; i = (i+1) & mask) {
+         if (x->hashes[i] != h) continue;
+         const size_t id = x->ids[i] - 1;
+         const char *key = x->keys + x->starts[id];
+         const size_t klen = x->starts[id+1] - x->starts[id];
+         // The key was found by another segment already.
+         if (x->tails[id] == best.node) continue;
+         int d = 0;
+         for (k = 0 ; k < klen ; k++) {
+            if (buf[k] == key[k]) continue;
+            if (buf[k] == '\n' || ++d > max_mismatches) break;
+         }
+         if (k < klen) continue;
+         if (best.node == NULL || d < best.dist ||
+               (d == best.dist && klen > best.len)) {
+            best.node = x->tails[id];
+            best.len = klen;
+            best.dist = d;
+            best.ties = 0;
+         }
+         else if (d == best.dist && klen == best.len) {
+            best.ties++;
+         }
+      }
+   }
+
+   if (more != NULL) *more = 0;
+   *match_len = 0;
+   if (best.node == NULL || best.ties > 0) return NULL;
+
+   *match_len = best.len;
+   return best.node;
+
+}
+
+
+void hm_free_index(hm_index *x) {
+
+   if (x == NULL) return;
+   free(x->hashes);
+   free(x->ids);
+   free(x->keys);
+   free(x->starts);
+   free(x->tails);
+   free(x);
+
+}
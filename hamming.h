@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "radixtrie.h"
+
+#ifndef _HAMMING_H
+#define _HAMMING_H
+
+#define MAX_PROBES 64
+
+typedef
+struct
+/*********************************************************************
+  Pigeonhole index of a key set for up to 'd' mismatches. Every key is
+  cut in 'd+1' segments, at least one of which matches exactly if the
+  key matches with at most 'd' mismatches.
+    'span'   : length of the longest key
+    'nprobes': number of distinct (offset, length) segment positions
+    'offsets': offset of the segments in the keys
+    'lengths': length of the segments
+    'bits'   : log2 of the number of slots
+    'hashes' : hash of the segment in every slot
+    'ids'    : index of the key of the segment + 1, 0 if empty
+    'keys'   : the keys, one after the other
+    'starts' : offset of every key in 'keys' (and of the end)
+    'tails'  : tail nodes of the keys in the trie (value and key id)
+*********************************************************************/
+{
+   size_t      span;
+   int         nprobes;
+   size_t      offsets[MAX_PROBES];
+   size_t      lengths[MAX_PROBES];
+   int         bits;
+   uint64_t   *hashes;
+   uint32_t   *ids;
+   char       *keys;
+   size_t     *starts;
+   rt_node   **tails;
+}
+hm_index;
+
+
+void rt_set_mismatches(int);
+rt_node *rt_match_hamming(const char *, size_t, rt_node *, size_t *, int *);
+hm_index *hm_build_index(rt_node *, int);
+rt_node *hm_match(const hm_index *, const char *, size_t, rt_node *,
+      size_t *, int *);
+void hm_free_index(hm_index *);
+
+#endif
@@ -0,0 +1,118 @@
+#include "iupac.h"
+
+/*
+IUPAC degenerate keys. The key letters are stored as is in the trie,
+and a key letter that is an IUPAC code matches any of the bases it
+stands for (e.g. 'R' matches 'A' or 'G', 'N' matches any base). Other
+characters match themselves. Input characters are not interpreted,
+so an 'N' in the input is matched only by a key 'N'. Codes are upper
+case, and 'U' stands for 'T'.
+*/
+
+#define A 1
+#define C 2
+#define G 4
+#define T 8
+
+static const unsigned char BASES[256] = {
+   ['A'] = A, ['C'] = C, ['G'] = G, ['T'] = T,
+};
+
+static const unsigned char CODES[256] = {
+   ['A'] = A, ['C'] = C, ['G'] = G, ['T'] = T, ['U'] = T,
+   ['R'] = A|G, ['Y'] = C|T, ['S'] = C|G, ['W'] = A|T,
+   ['K'] = G|T, ['M'] = A|C,
+   ['B'] = C|G|T, ['D'] = A|G|T, ['H'] = A|C|T, ['V'] = A|C|G,
+   ['N'] = A|C|G|T,
+};
+
+
+static inline int iupac_eq(const char key, const char c) {
+// Return 1 if key letter 'key' matches input character 'c'.
+
+   const unsigned char code = CODES[(unsigned char) key];
+   if (code == 0) return key == c;
+   return (code & BASES[(unsigned char) c]) != 0;
+
+}
+
+
+static void match_iupac(const char *buf, size_t len, rt_node *parent,
+      size_t pos, rt_node **match_node, size_t *match_len, int *more) {
+// Depth-first search of all the paths that match 'buf'. Several
+// children of a node can match the same character, so every one of
+// them is explored. A match replaces the current one only if it is
+// strictly longer: for equal lengths, the first path found wins.
+
+   rt_node *child;
+   int i, j;
+
+   for (i = 0 ; (child = parent->children[i]) != NULL ; i++) {
+      for (j = 0 ; child->subkey[j] != '\0' ; j++) {
+         if (pos + j >= len) {
+            *more = 1;
+            break;
+         }
+         if (!iupac_eq(child->subkey[j], buf[pos+j])) break;
+      }
+      if (child->subkey[j] != '\0') continue;
+      if (child->data != NULL && pos + j > *match_len) {
+         *match_node = child;
+         *match_len = pos + j;
+      }
+      match_iupac(buf, len, child, pos + j, match_node, match_len, more);
+   }
+
+}
+
+
+rt_node *rt_match_iupac(const char *buf, size_t len, rt_node *root,
+      size_t *match_len, int *more) {
+// Same as 'rt_match_buf()' for a trie built from degenerate keys.
+
+   rt_node *match_node = NULL;
+   int dummy;
+
+   *match_len = 0;
+   if (more == NULL) more = &dummy;
+   *more = 0;
+
+   match_iupac(buf, len, root, 0, &match_node, match_len, more);
+
+   return match_node;
+
+}
+
+
+static int specificity(const rt_node *node) {
+// Number of input characters matched by the first key letter.
+
+   const unsigned char code = CODES[(unsigned char) node->subkey[0]];
+   return __builtin_popcount(code == 0 ? 1 : code);
+
+}
+
+
+static int cmp_specificity(const void *a, const void *b) {
+   const rt_node *na = *(rt_node * const *) a;
+   const rt_node *nb = *(rt_node * const *) b;
+   if (specificity(na) != specificity(nb)) {
+      return specificity(na) - specificity(nb);
+   }
+   return (unsigned char) na->subkey[0] - (unsigned char) nb->subkey[0];
+}
+
+
+void rt_sort_iupac(rt_node *node) {
+// Order the children of every node from the most to the least
+// specific first letter, so that on keys of equal length the search
+// in 'rt_match_iupac()' prefers literal bases over degenerate codes.
+
+   int i;
+   for (i = 0 ; node->children[i] != NULL ; i++) {
+      rt_sort_iupac(node->children[i]);
+   }
+
+   qsort(node->children, i, sizeof(rt_node *), cmp_specificity);
+
+}
@@ -0,0 +1,12 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "radixtrie.h"
+
+#ifndef _IUPAC_H
+#define _IUPAC_H
+
+rt_node *rt_match_iupac(const char *, size_t, rt_node *, size_t *, int *);
+void rt_sort_iupac(rt_node *);
+
+#endif
@@ -0,0 +1,192 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "placement.h"
+
+/*
+Placement of the read-only trie in memory: huge pages to reduce TLB
+misses, and one copy per NUMA node so that threads read local memory.
+NUMA nodes are read from sysfs and copies are placed by first touch
+(the copy is written by a thread that runs on the node), so there is
+no dependency on libnuma.
+*/
+
+
+void *huge_alloc(size_t size) {
+// Allocate 'size' bytes on 2 MB pages: from the huge page pool if
+// there is one, otherwise on a 2 MB aligned mapping with transparent
+// huge pages requested by 'madvise'. Return NULL upon failure. There
+// is no matching free: the tries are kept until the process exits.
+
+   size_t len = (size + HUGE_PAGE_SIZE - 1) &
+         ~((size_t) HUGE_PAGE_SIZE - 1);
+   char *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+   if (p == MAP_FAILED) {
+      // Map one more huge page and trim to 2 MB boundaries.
+      char *q = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (q == MAP_FAILED) return NULL;
+      p = (char *) (((uintptr_t) q + HUGE_PAGE_SIZE - 1) &
+            ~((uintptr_t) HUGE_PAGE_SIZE - 1));
+      if (p > q) munmap(q, p - q);
+      munmap(p + len, q + HUGE_PAGE_SIZE - p);
+      madvise(p, len, MADV_HUGEPAGE);
+   }
+
+   return p;
+
+}
+
+
+long huge_pages_kb(const void *ptr) {
+// Return the kB of huge pages backing the mapping of 'ptr' (from
+// '/proc/self/smaps'), or -1 if unknown. 'AnonHugePages' comes before
+// 'Private_Hugetlb', so the whole entry is read: explicit huge pages
+// win when there are some, transparent huge pages otherwise.
+
+   FILE *f = fopen("/proc/self/smaps", "r");
+   if (f == NULL) return -1;
+
+   char line[512];
+   unsigned long start, end;
+   long kb, anon = -1, hugetlb = -1;
+   int inside = 0;
+
+   while (fgets(line, sizeof(line), f) != NULL) {
+      // Header line of a mapping ('start-end perms ...').
+      if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+         if (inside) break;
+         inside = (uintptr_t) ptr >= start && (uintptr_t) ptr < end;
+         continue;
+      }
+      if (!inside) continue;
+      if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) anon = kb;
+      if (sscanf(line, "Private_Hugetlb: %ld kB", &kb) == 1) hugetlb = kb;
+   }
+
+   fclose(f);
+   return hugetlb > 0 ? hugetlb : anon;
+
+}
+
+
+int numa_node_count(void) {
+// Number of NUMA nodes (the highest online node plus one), 1 if the
+// information is not available.
+
+   FILE *f = fopen("/sys/devices/system/node/online", "r");
+   if (f == NULL) return 1;
+
+   int node, last = 0;
+   char sep;
+   while (fscanf(f, "%d%c", &node, &sep) >= 1) {
+      if (node > last) last = node;
+   }
+   fclose(f);
+
+   return last + 1 > MAX_NODES ? MAX_NODES : last + 1;
+
+}
+
+
+int numa_pin_attr(pthread_attr_t *attr, int node) {
+// Restrict the threads created with 'attr' to the CPUs of 'node'.
+// Return 1 upon success, 0 upon failure.
+
+   char path[64];
+   sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+   FILE *f = fopen(path, "r");
+   if (f == NULL) return 0;
+
+   cpu_set_t set;
+   CPU_ZERO(&set);
+
+   // Format is e.g. '0-7,16-23'.
+   int first, last, n;
+   while ((n = fscanf(f, "%d-%d", &first, &last)) >= 1) {
+      if (n == 1) last = first;
+      for ( ; first <= last ; first++) CPU_SET(first, &set);
+      if (fgetc(f) != ',') break;
+   }
+   fclose(f);
+
+   if (CPU_COUNT(&set) == 0) return 0;
+   return pthread_attr_setaffinity_np(attr, sizeof(set), &set) == 0;
+
+}
+
+
+typedef
+struct
+{
+   rt_node   *root;
+   size_t     size;
+   void    *(*alloc)(size_t);
+   rt_node   *copy;
+}
+replica;
+
+static void *replicate(void *arg) {
+   replica *r = (replica *) arg;
+   r->copy = rt_clone_frozen(r->root, r->size, r->alloc);
+   return NULL;
+}
+
+
+rt_node *numa_replicate(rt_node *root, size_t size, int node,
+      void *(*alloc)(size_t)) {
+// Copy the frozen trie 'root' of 'size' bytes from a thread running
+// on 'node', so that the pages of the copy are local to the node.
+
+   pthread_attr_t attr;
+   pthread_t thread;
+   replica r = { .root = root, .size = size, .alloc = alloc,
+      .copy = NULL };
+
+   pthread_attr_init(&attr);
+   numa_pin_attr(&attr, node);
+   if (pthread_create(&thread, &attr, replicate, &r) == 0) {
+      pthread_join(thread, NULL);
+   }
+   pthread_attr_destroy(&attr);
+
+   return r.copy;
+
+}
+
+
+int tlb_counter_open(void) {
+// Count the data TLB load misses of this thread and of the threads
+// it creates. Return a file descriptor, or -1 if not available.
+
+   struct perf_event_attr pe;
+   memset(&pe, 0, sizeof(pe));
+   pe.type = PERF_TYPE_HW_CACHE;
+   pe.size = sizeof(pe);
+   pe.config = PERF_COUNT_HW_CACHE_DTLB |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+   pe.inherit = 1;
+   pe.exclude_kernel = 1;
+   pe.exclude_hv = 1;
+
+   return syscall(SYS_perf_event_open, &pe, 0, -1, -1, 0);
+
+}
+
+
+long long tlb_counter_read(int fd) {
+
+   long long count;
+   if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) {
+      return -1;
+   }
+   return count;
+
+}
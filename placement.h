@@ -0,0 +1,21 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "radixtrie.h"
+
+#ifndef _PLACEMENT_H
+#define _PLACEMENT_H
+
+#define HUGE_PAGE_SIZE (1 << 21)
+#define MAX_NODES 16
+
+void *huge_alloc(size_t);
+long huge_pages_kb(const void *);
+int numa_node_count(void);
+int numa_pin_attr(pthread_attr_t *, int);
+rt_node *numa_replicate(rt_node *, size_t, int, void *(*)(size_t));
+int tlb_counter_open(void);
+long long tlb_counter_read(int);
+
+#endif
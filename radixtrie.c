@@ -1,41 +1,7 @@
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-#include "array_lookup.h"
-
-#ifdef TARGET_OS_MAC
-#include "lib/fmemopen/fmemopen.h"
-#endif
-
-#define MAX_KEY_LENGTH 65536
-
-typedef
-struct rt_node
-/************************************************************************
-  Radix trie node with the following attributes.                         
-     'subkey' : substring on a key path.                                 
-     'data'   : char pointer on data for tail node, 'NULL' otherwise     
-     'childen': array of pointers to child nodes.                        
-                                                                         
-  The 'children' array is terminated by a 'NULL' slot. A node with a     
-  single 'NULL' child node slot is a leaf.                               
-                                                                         
-  A tail node is the last node in a path that matches a  key. Non tail   
-  nodes have a 'data' pointer set to 'NULL'. Tail nodes do not need to   
-  be leaves because they can have child nodes in case a key prefixes     
-  another key.                                                           
-                                                                         
-************************************************************************/
-{
-              char   *subkey;
-              char   *data;
-    struct rt_node   **children;
-}
-rt_node;
-
-
+#include "radixtrie.h"
 
 rt_node *create_orphan_node(char *subkey, char *data) {
+// The node points to 'data', which is not copied and must outlive it.
 
    rt_node *orphan = (rt_node *) malloc(sizeof(rt_node));
    rt_node **no_child = (rt_node **) malloc(sizeof(rt_node *));
@@ -44,14 +10,9 @@ rt_node *create_orphan_node(char *subkey, char *data) {
    orphan->subkey = (char *) malloc((1 + strlen(subkey)) * sizeof(char));
    strcpy(orphan->subkey, subkey);
 
-   if (data != NULL) {
-      orphan->data =(char *) malloc((1 + strlen(data)) * sizeof(char));
-      strcpy(orphan->data, data);
-   }
-   else {
-      orphan->data = NULL;
-   }
-          
+   orphan->data = data;
+   orphan->keyid = -1;
+   orphan->hits = 0;
    orphan->children = no_child;
 
    return orphan;
@@ -152,32 +113,128 @@ rt_node *rt_match(FILE *stream, rt_node *root) {
 }
 
 
-void  add_key(rt_node *root, char *suff, char *data) {
+rt_node *rt_match_buf(const char *buf, size_t len, rt_node *root,
+      size_t *match_len, int *more) {
+// Match the longest key at the start of a memory buffer.
+// PARAMETERS:
+//    'buf'      : characters to match down the trie.
+//    'len'      : number of characters available in 'buf'.
+//    'root'     : Node to start matching from.
+//    'match_len': set to the length of the match (0 if none).
+//    'more'     : if not NULL, set to 1 if the walk reached the end of
+//                 'buf' with longer keys still possible, 0 otherwise.
+// RETURN:
+//    Pointer to the deepest tail node on the path (or NULL).
+
+   rt_node *parent = root;
+   rt_node *child;
+   rt_node *match_node = NULL;
+   size_t pos = 0;
+   int i, j;
+
+   *match_len = 0;
+   if (more != NULL) *more = 0;
+
+   while (pos < len) {
+      // Siblings start with different characters, so at most one
+      // child can match and the first character decides which.
+      for (i = 0 ; (child = parent->children[i]) != NULL ; i++) {
+         if (child->subkey[0] == buf[pos]) break;
+      }
+      if (child == NULL) return match_node;
+
+      for (j = 1 ; child->subkey[j] != '\0' ; j++) {
+         if (pos + j >= len || buf[pos+j] != child->subkey[j]) break;
+      }
+      if (child->subkey[j] != '\0') {
+         if (more != NULL) *more = pos + j >= len;
+         return match_node;
+      }
+
+      pos += j;
+      parent = child;
+      if (child->data != NULL) {
+         match_node = child;
+         *match_len = pos;
+      }
+   }
+
+   if (more != NULL) *more = parent->children[0] != NULL;
+   return match_node;
+
+}
+
+
+rt_node *rt_match_from(const char *buf, size_t len, rt_node *root,
+      size_t *pos, size_t *match_len, int *more) {
+// Match the trie at every position of a buffer from '*pos' on, until a
+// match or an undecided position. The table engines call it near the
+// end of the buffer, where their windows do not fit, so that only the
+// positions that can start a key longer than the buffer are held.
+// PARAMETERS:
+//    'buf', 'len', 'root', 'match_len': as in 'rt_match_buf()'.
+//    'pos'      : first position to match, set to the position of the
+//                 match, of the undecided position, or to 'len'.
+//    'more'     : set to 1 if the match at '*pos' is not decided by
+//                 the characters of 'buf', 0 otherwise.
+// RETURN:
+//    Pointer to the tail node of the match (or NULL).
+
+   rt_node *match;
+   size_t j;
+
+   for (j = *pos ; j < len ; j++) {
+      match = rt_match_buf(buf + j, len - j, root, match_len, more);
+      if (match != NULL || *more) {
+         *pos = j;
+         return match;
+      }
+   }
+
+   *pos = len;
+   *match_len = 0;
+   *more = 0;
+   return NULL;
+
+}
+
 
-   // Find node where to add key suffix.
-   FILE *keystream = fmemopen(suff, MAX_KEY_LENGTH, "r");
-   rt_node *node = rt_match(keystream, root);
-   if (node == NULL) node = root;
-   suff += ftell(keystream);
-   fclose(keystream);
+void add_key(rt_node *root, char *suff, char *data, int keyid) {
+// Insert key 'suff' with replacement 'data' in the trie. The key
+// index 'keyid' is stored in the tail node, which points to 'data'
+// (not copied).
 
+   rt_node *node = root;
+   rt_node *child;
    int i;
    int j;
-   char *subkey;
+
+   // Descend along the children that match 'suff' entirely.
+   for (i = 0 ; (child = node->children[i]) != NULL ; i++) {
+      j = strlen(child->subkey);
+      if (strncmp(suff, child->subkey, j) == 0) {
+         suff += j;
+         node = child;
+         i = -1;
+      }
+   }
+
    char pref[MAX_KEY_LENGTH];
-   rt_node *child;
 
    // If 'suff' shares prefix with a child, add internal node.
    for (i = 0 ; (child = node->children[i]) != NULL ; i++) {
 
-      subkey = child->subkey;
-      for (j = 0 ; suff[j] != '\0' &&  suff[j] != subkey[j]; j++) {
+      char *subkey = child->subkey;
+      for (j = 0 ; suff[j] != '\0' &&  suff[j] == subkey[j]; j++) {
          pref[j] = suff[j];
       }
       pref[j] = '\0';
 
       if (j > 0) {
-         child->subkey += j;
+         // Keep the subkey at the start of its own allocation so that
+         // the node can be freed.
+         memmove(child->subkey, child->subkey + j,
+               strlen(child->subkey + j) + 1);
          suff += j;
          rt_node *internal_node = create_orphan_node(pref, NULL);
          add_as_child(child, internal_node);
@@ -187,26 +244,314 @@ void  add_key(rt_node *root, char *suff, char *data) {
       }
    }
 
+   if (*suff == '\0') {
+      // The key ends on an existing node, which becomes a tail.
+      node->data = data;
+      node->keyid = keyid;
+      return;
+   }
+
    rt_node *leaf = create_orphan_node(suff, data);
+   leaf->keyid = keyid;
    add_as_child(leaf, node);
-   
+
+}
+
+
+void rt_free(rt_node *node) {
+// Free 'node' and all its descendants (but not their data).
+
+   int i;
+   for (i = 0 ; node->children[i] != NULL ; i++) {
+      rt_free(node->children[i]);
+   }
+
+   free(node->children);
+   free(node->subkey);
+   free(node);
+
+}
+
+
+static int walk_tails(rt_node *node, char *path, size_t depth,
+      int (*visit)(rt_node *, const char *, size_t, void *), void *arg) {
+
+   size_t len = strlen(node->subkey);
+   memcpy(path + depth, node->subkey, len);
+   depth += len;
+
+   if (node->data != NULL && !visit(node, path, depth, arg)) return 0;
+
+   int i;
+   for (i = 0 ; node->children[i] != NULL ; i++) {
+      if (!walk_tails(node->children[i], path, depth, visit, arg)) return 0;
+   }
+
+   return 1;
+
+}
+
+
+int rt_walk_keys(rt_node *root,
+      int (*visit)(rt_node *, const char *, size_t, void *), void *arg) {
+// Call 'visit(tail, key, len, arg)' on every tail node of the trie in
+// depth-first order, with the key of the node (not '\0'-terminated).
+// The walk stops if 'visit' returns 0. Return 1 if every key was
+// visited, 0 if the walk was stopped or upon memory failure.
+
+   char *path = (char *) malloc(MAX_KEY_LENGTH * sizeof(char));
+   if (path == NULL) return 0;
+
+   int done = walk_tails(root, path, 0, visit, arg);
+   free(path);
+
+   return done;
+
 }
 
 
-int main(void) {
-   FILE *f = fopen("testfile.txt", "r");
-   array_lookup lookup = generate_array_lookup_from_file(f);
+void rt_profile_buf(const char *buf, size_t len, rt_node *root) {
+// Training run: match 'buf' from left to right as in replacement mode
+// and count in 'hits' how many times every edge of the trie is taken.
+
+   rt_node *parent;
+   rt_node *child;
+   size_t match_len;
+   size_t pos;
+   size_t i = 0;
+   int j, k;
+
+   while (i < len) {
+      parent = root;
+      match_len = 0;
+      pos = i;
+      while (pos < len) {
+         for (k = 0 ; (child = parent->children[k]) != NULL ; k++) {
+            if (child->subkey[0] == buf[pos]) break;
+         }
+         if (child == NULL) break;
+         child->hits++;
+         for (j = 1 ; child->subkey[j] != '\0' ; j++) {
+            if (pos + j >= len || buf[pos+j] != child->subkey[j]) break;
+         }
+         if (child->subkey[j] != '\0') break;
+         pos += j;
+         parent = child;
+         if (child->data != NULL) match_len = pos - i;
+      }
+      i += match_len > 0 ? match_len : 1;
+   }
+
+}
+
+
+static void save_node_profile(FILE *f, rt_node *node, char *path,
+      size_t depth) {
+
+   size_t len = strlen(node->subkey);
+   memcpy(path + depth, node->subkey, len);
+   path[depth+len] = '\0';
+
+   if (node->hits > 0) fprintf(f, "%lu\t%s\n", node->hits, path);
 
-   rt_node *root = create_orphan_node("", NULL);
    int i;
-   for (i = 0 ; i < lookup.item_nb ; i++) {
-      add_key(root, lookup.keys[i], lookup.values[i]);
+   for (i = 0 ; node->children[i] != NULL ; i++) {
+      save_node_profile(f, node->children[i], path, depth + len);
    }
 
-   dealloc_array_lookup(&lookup);
+}
+
+
+int rt_save_profile(FILE *f, rt_node *root) {
+// Write the edge hits of the trie, one 'hits<tab>path' line per node
+// that was entered at least once. Return 1 upon success, 0 upon
+// failure.
+
+   char path[MAX_KEY_LENGTH];
+   save_node_profile(f, root, path, 0);
+
+   return ferror(f) ? 0 : 1;
+
+}
+
+
+int rt_load_profile(FILE *f, rt_node *root) {
+// Read edge hits written by 'rt_save_profile()'. Lines that do not
+// match a node (e.g. because the key set changed) are ignored. Return
+// 1 upon success, 0 upon failure.
+
+   char line[MAX_KEY_LENGTH + 32];
+   char *path;
+   unsigned long hits;
+   rt_node *node;
+   rt_node *child;
+   int i, len;
+
+   while (fgets(line, sizeof(line), f) != NULL) {
+      hits = strtoul(line, &path, 10);
+      if (*path++ != '\t') return 0;
+      len = strlen(path);
+      if (len > 0 && path[len-1] == '\n') path[--len] = '\0';
+      // Follow the path down the trie.
+      node = root;
+      while (*path != '\0') {
+         for (i = 0 ; (child = node->children[i]) != NULL ; i++) {
+            len = strlen(child->subkey);
+            if (strncmp(path, child->subkey, len) == 0) break;
+         }
+         if (child == NULL) break;
+         path += len;
+         node = child;
+      }
+      if (*path == '\0') node->hits = hits;
+   }
+
+   return ferror(f) ? 0 : 1;
+
+}
+
+
+static int cmp_hits(const void *a, const void *b) {
+// Sort nodes by decreasing hits.
+   const rt_node *na = *(rt_node * const *) a;
+   const rt_node *nb = *(rt_node * const *) b;
+   return (na->hits < nb->hits) - (na->hits > nb->hits);
+}
+
+
+static void count_nodes(rt_node *node, size_t *nodes, size_t *bytes) {
+
+   *nodes += 1;
+   *bytes += strlen(node->subkey) + 1;
+   if (node->data != NULL) *bytes += strlen(node->data) + 1;
+
+   int i;
+   for (i = 0 ; node->children[i] != NULL ; i++) {
+      count_nodes(node->children[i], nodes, bytes);
+      // A profile of another key set may leave hot nodes under cold
+      // ones: a node is at least as hot as its children.
+      if (node->children[i]->hits > node->hits) {
+         node->hits = node->children[i]->hits;
+      }
+   }
+
+   // Most frequent edges first.
+   qsort(node->children, i, sizeof(rt_node *), cmp_hits);
+
+}
+
+
+rt_node *rt_freeze(rt_node *root, void *(*alloc)(size_t), size_t *size) {
+// Copy the trie to a single block allocated with 'alloc' (nodes, then
+// child pointers, then strings) and free the original. Nodes are laid
+// out breadth-first, the nodes entered during training before all the
+// others, so that hot paths share cache lines and pages. Children are
+// sorted by decreasing hits, so 'rt_match_buf()' tries the frequent
+// edges first. The size of the block is stored in 'size'. The frozen
+// trie is read-only and the block starts at the root: it is released
+// by the function that matches 'alloc' ('free()' for 'malloc()').
+
+   size_t nb_nodes = 0;
+   size_t nb_bytes = 0;
+   count_nodes(root, &nb_nodes, &nb_bytes);
+
+   *size = nb_nodes * (sizeof(rt_node) + 2 * sizeof(rt_node *)) + nb_bytes;
+   rt_node **order = (rt_node **) malloc(nb_nodes * sizeof(rt_node *));
+   rt_node *nodes = order == NULL ? NULL : (rt_node *) alloc(*size);
+   if (nodes == NULL) {
+      // Keep the original trie.
+      free(order);
+      *size = 0;
+      return root;
+   }
+   rt_node **slots = (rt_node **) (nodes + nb_nodes);
+   char *pool = (char *) (slots + 2 * nb_nodes);
+
+   size_t head;
+   size_t tail = 0;
+   int i;
+
+   // Breadth-first over the hot nodes, then over the cold ones.
+   order[tail++] = root;
+   for (head = 0 ; head < tail ; head++) {
+      for (i = 0 ; order[head]->children[i] != NULL ; i++) {
+         if (order[head]->children[i]->hits > 0) {
+            order[tail++] = order[head]->children[i];
+         }
+      }
+   }
+   for (head = 0 ; head < tail ; head++) {
+      for (i = 0 ; order[head]->children[i] != NULL ; i++) {
+         if (order[head]->children[i]->hits == 0) {
+            order[tail++] = order[head]->children[i];
+         }
+      }
+   }
+
+   // Copy nodes and strings, then use 'hits' of the original nodes
+   // to remember their new position.
+   size_t k;
+   char *s = pool;
+   for (k = 0 ; k < nb_nodes ; k++) {
+      nodes[k] = *order[k];
+      nodes[k].subkey = strcpy(s, order[k]->subkey);
+      s += strlen(s) + 1;
+      if (order[k]->data != NULL) {
+         nodes[k].data = strcpy(s, order[k]->data);
+         s += strlen(s) + 1;
+      }
+   }
+   for (k = 0 ; k < nb_nodes ; k++) order[k]->hits = k;
+
+   rt_node **slot = slots;
+   for (k = 0 ; k < nb_nodes ; k++) {
+      nodes[k].children = slot;
+      for (i = 0 ; order[k]->children[i] != NULL ; i++) {
+         *slot++ = nodes + order[k]->children[i]->hits;
+      }
+      *slot++ = NULL;
+   }
+   // Unused slots (there are 2 per node for 'nb_nodes-1' children and
+   // 'nb_nodes' sentinels).
+   while (slot < slots + 2 * nb_nodes) *slot++ = NULL;
+
+   free(order);
+   rt_free(root);
+
+   return nodes;
+
+}
+
+
+
+rt_node *rt_clone_frozen(rt_node *root, size_t size,
+      void *(*alloc)(size_t)) {
+// Copy a frozen trie of 'size' bytes to a block allocated with
+// 'alloc'. The block is copied as is and the pointers are relocated.
+// The root is the first node, its children the first slots and its
+// subkey the first string, which gives the bounds of every part.
+
+   char *base = (char *) alloc(size);
+   if (base == NULL) return NULL;
+   memcpy(base, root, size);
+
+   const ptrdiff_t delta = base - (char *) root;
+   const size_t nb_nodes = (rt_node *) root->children - root;
+   rt_node *nodes = (rt_node *) base;
+   rt_node **slots = (rt_node **) (nodes + nb_nodes);
+   size_t k;
+
+   #define RELOCATE(p) ((p) = (void *) ((char *) (p) + delta))
+   for (k = 0 ; k < nb_nodes ; k++) {
+      RELOCATE(nodes[k].subkey);
+      if (nodes[k].data != NULL) RELOCATE(nodes[k].data);
+      RELOCATE(nodes[k].children);
+   }
+   for (k = 0 ; k < 2 * nb_nodes ; k++) {
+      if (slots[k] != NULL) RELOCATE(slots[k]);
+   }
+   #undef RELOCATE
 
-   FILE *stream = fmemopen("A", 256, "r");
-   rt_node *match = rt_match(stream, root);
-   printf("%s\n", match->data);
+   return nodes;
 
 }
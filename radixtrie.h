@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#ifndef _RADIXTRIE_H
+#define _RADIXTRIE_H
+
+#define MAX_KEY_LENGTH 65536
+
+typedef
+struct rt_node
+/************************************************************************
+  Radix trie node with the following attributes.
+     'subkey' : substring on a key path.
+     'data'   : char pointer on data for tail node, 'NULL' otherwise
+                (owned by the caller, e.g. the pool of the key lookup)
+     'keyid'  : index of the key in the lookup for tail node, -1 otherwise
+     'hits'   : number of times the node was entered in a training run
+     'childen': array of pointers to child nodes.
+
+  The 'children' array is terminated by a 'NULL' slot. A node with a
+  single 'NULL' child node slot is a leaf.
+
+  A tail node is the last node in a path that matches a  key. Non tail
+  nodes have a 'data' pointer set to 'NULL'. Tail nodes do not need to
+  be leaves because they can have child nodes in case a key prefixes
+  another key.
+
+************************************************************************/
+{
+              char   *subkey;
+              char   *data;
+               int   keyid;
+     unsigned long   hits;
+    struct rt_node   **children;
+}
+rt_node;
+
+
+rt_node *create_orphan_node(char *, char *);
+int add_as_child(rt_node *, rt_node *);
+void add_key(rt_node *, char *, char *, int);
+rt_node *rt_match(FILE *, rt_node *);
+rt_node *rt_match_buf(const char *, size_t, rt_node *, size_t *, int *);
+rt_node *rt_match_from(const char *, size_t, rt_node *, size_t *, size_t *,
+      int *);
+void rt_free(rt_node *);
+int rt_walk_keys(rt_node *, int (*)(rt_node *, const char *, size_t, void *),
+      void *);
+void rt_profile_buf(const char *, size_t, rt_node *);
+int rt_save_profile(FILE *, rt_node *);
+int rt_load_profile(FILE *, rt_node *);
+rt_node *rt_freeze(rt_node *, void *(*)(size_t), size_t *);
+rt_node *rt_clone_frozen(rt_node *, size_t, void *(*)(size_t));
+
+#endif
@@ -0,0 +1,885 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include "array_lookup.h"
+#include "radixtrie.h"
+#include "shard.h"
+#include "iupac.h"
+#include "placement.h"
+#include "fixed.h"
+#include "hamming.h"
+#include "skip.h"
+
+/*
+radixtrie: multiple stream replacement with a radix trie
+USAGE:
+  radixtrie [options] keyfile [targetfile [outfile]]
+*/
+
+#define BLOCK_SIZE (1 << 22)
+#define MAX_THREADS 64
+#define MAX_PASSES 16
+
+// Automatic choice of the skip engine.
+#define SKIP_AUTO_MAX_KEYS 4096
+#define SKIP_AUTO_MIN_LENGTH 8
+#define SKIP_AUTO_MIN_ALPHABET 8
+
+typedef enum {
+   REPLACE,
+   COUNT,
+   POSITIONS_TSV,
+   POSITIONS_BIN,
+}
+output_mode;
+
+typedef enum {
+   AUTO_ENGINE,
+   TRIE_ENGINE,
+   HASH_ENGINE,
+   SKIP_ENGINE,
+}
+engine_type;
+
+static const char *ENGINE_NAMES[] = {"auto", "trie", "hash", "skip"};
+
+typedef
+struct
+/*********************************************************************
+  Binary record of a match for '--positions=bin'. Records are written
+  in native byte order, in the order of the matches in the stream.
+    'keyid' : index of the key in the sorted key file
+    'length': length of the match in bytes
+    'offset': byte offset of the match in the input stream
+*********************************************************************/
+{
+   uint32_t   keyid;
+   uint32_t   length;
+   uint64_t   offset;
+}
+match_record;
+
+typedef
+struct
+/*********************************************************************
+  Portion of the stream processed by one thread.
+    'buf'   : first character of the chunk
+    'len'   : number of characters in the chunk
+    'offset': byte offset of 'buf' in the input stream
+    'outf'  : where to write (a memory stream in threaded mode)
+    'counts': per-key match counts, merged after the last chunk
+    'hold'  : stop before a match that could depend on the next bytes
+    'done'  : number of characters processed
+    'roots' : tries of the passes (the copy of the thread's NUMA node)
+    'node'  : NUMA node of the thread, -1 if not pinned
+*********************************************************************/
+{
+   const char    *buf;
+   size_t         len;
+   size_t         offset;
+   FILE          *outf;
+   char          *out;
+   size_t         outlen;
+   long          *counts;
+   int            hold;
+   size_t         done;
+   rt_node      **roots;
+   int            node;
+}
+chunk;
+
+static rt_node *roots[MAX_PASSES];
+static rt_node *replicas[MAX_NODES][MAX_PASSES];
+static fixed_table *tables[MAX_PASSES];
+static hm_index *indexes[MAX_PASSES];
+static skip_table *skips[MAX_PASSES];
+static int npasses = 0;
+static shard_index *shards = NULL;
+static output_mode mode = REPLACE;
+static rt_node *(*match_fn)(const char *, size_t, rt_node *, size_t *, int *)
+   = rt_match_buf;
+
+
+void exit_memory_failure(void) {
+   fprintf(stderr, "memory error\n");
+   exit(EXIT_FAILURE);
+}
+
+
+size_t whip_buffer(chunk *c, const char *buf, size_t len, const int p,
+      const output_mode mode, FILE *outf) {
+// Run the leftmost-longest match of the keys of pass 'p' over 'buf'.
+// In 'REPLACE' mode the unmatched characters are copied and matches
+// are replaced by their value, in the other modes nothing but the
+// matches are reported. The trie can be helped by the hash table of
+// keys of a single length, or by the shift table of long keys.
+// If 'hold' is set, stop at the first position where the match is
+// not decided by the characters of the buffer. Return the number of
+// characters processed.
+
+   size_t i = 0;
+   size_t run = 0;
+   size_t match_len;
+   rt_node *match;
+   rt_node *r = c->roots[p];
+   const fixed_table *fixed = tables[p];
+   const hm_index *index = indexes[p];
+   const skip_table *skip = skips[p];
+   int more = 0;
+
+   while (i < len) {
+      if (fixed != NULL) {
+         // Jump to the next key, 'i' is 'len' if there is none.
+         match = fixed_next(fixed, buf, len, r, &i, &more);
+         match_len = fixed->klen;
+      }
+      else if (skip != NULL) {
+         // Jump over the positions where no key can start.
+         match = skip_next(skip, buf, len, r, &i, &match_len, &more);
+      }
+      else if (shards != NULL) {
+         // The prefix of the position selects the shard.
+         match = shard_match(shards, buf + i, len - i, &match_len, &more);
+      }
+      else {
+         // With mismatches, compare only the keys of the index hits.
+         if (index != NULL) {
+            match = hm_match(index, buf + i, len - i, r, &match_len, &more);
+         }
+         else match = match_fn(buf + i, len - i, r, &match_len, &more);
+      }
+      if (more && c->hold) break;
+      if (match == NULL) {
+         // The tables return no match only at an undecided position
+         // or when there is no match up to the end of the buffer.
+         i = (fixed == NULL && skip == NULL) || more ? i+1 : len;
+         continue;
+      }
+      switch (mode) {
+         case REPLACE:
+            fwrite(buf + run, 1, i - run, outf);
+            fputs(match->data, outf);
+            break;
+         case COUNT:
+            c->counts[match->keyid]++;
+            break;
+         case POSITIONS_TSV:
+            fprintf(outf, "%d\t%zu\t%zu\n", match->keyid,
+                  c->offset + i, match_len);
+            break;
+         case POSITIONS_BIN: {
+            match_record rec = {
+               .keyid  = match->keyid,
+               .length = match_len,
+               .offset = c->offset + i,
+            };
+            fwrite(&rec, sizeof(match_record), 1, outf);
+            break;
+         }
+      }
+      i += match_len;
+      run = i;
+   }
+
+   if (mode == REPLACE) fwrite(buf + run, 1, i - run, outf);
+
+   return i;
+
+}
+
+
+void *whip_chunk(void *arg) {
+// Apply the key sets to a chunk in turn, as a pipeline of whiplace
+// calls would. The output of a pass stays in memory and is the input
+// of the next pass, the output mode applies to the last pass. Values
+// contain no '\n' either, so the output of a chunk of complete lines
+// is made of complete lines and the chunks stay independent.
+
+   chunk *c = (chunk *) arg;
+   const char *buf = c->buf;
+   size_t len = c->len;
+   char *prev = NULL;
+   char *pass_out;
+   size_t pass_len;
+   int p;
+
+   for (p = 0 ; p < npasses - 1 ; p++) {
+      FILE *f = open_memstream(&pass_out, &pass_len);
+      if (f == NULL) exit_memory_failure();
+      whip_buffer(c, buf, len, p, REPLACE, f);
+      fclose(f);
+      free(prev);
+      buf = prev = pass_out;
+      len = pass_len;
+   }
+
+   c->done = whip_buffer(c, buf, len, npasses-1, mode, c->outf);
+   if (npasses > 1) c->done = c->len;
+   free(prev);
+
+   return NULL;
+
+}
+
+
+size_t whip_stream(FILE *streamf, FILE *outf, chunk *chunks,
+      const int nthreads) {
+// Read the stream by blocks of complete lines and split every block
+// between 'nthreads' threads. Keys cannot contain '\n', so matches
+// never span two lines and chunks can be processed independently.
+// Threads with a NUMA node run on the CPUs of that node. Return the
+// number of characters read.
+
+   size_t bufsize = BLOCK_SIZE * nthreads;
+   size_t filled = 0;
+   size_t offset = 0;
+   char *buf = (char *) malloc(bufsize * sizeof(char));
+   if (buf == NULL) exit_memory_failure();
+
+   pthread_t threads[MAX_THREADS];
+   int i;
+
+   while (1) {
+
+      filled += fread(buf + filled, 1, bufsize - filled, streamf);
+      const int eof = feof(streamf) || ferror(streamf);
+
+      // Process only complete lines, unless at the end of the stream.
+      size_t end = filled;
+      if (!eof) {
+         while (end > 0 && buf[end-1] != '\n') end--;
+         if (end == 0) {
+            // Line longer than the buffer: make room and read more.
+            bufsize *= 2;
+            buf = (char *) realloc(buf, bufsize * sizeof(char));
+            if (buf == NULL) exit_memory_failure();
+            continue;
+         }
+      }
+
+      // Cut the block after newlines.
+      size_t start = 0;
+      for (i = 0 ; i < nthreads ; i++) {
+         size_t cut = i == nthreads-1 ? end : end / nthreads * (i+1);
+         if (cut < start) cut = start;
+         while (cut > start && cut < end && buf[cut-1] != '\n') cut++;
+         chunks[i].buf = buf + start;
+         chunks[i].len = cut - start;
+         chunks[i].offset = offset + start;
+         start = cut;
+      }
+
+      if (nthreads == 1) {
+         chunks[0].outf = outf;
+         whip_chunk(chunks);
+      }
+      else {
+         for (i = 0 ; i < nthreads ; i++) {
+            chunks[i].outf = open_memstream(&chunks[i].out,
+                  &chunks[i].outlen);
+            if (chunks[i].outf == NULL) exit_memory_failure();
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            if (chunks[i].node >= 0) numa_pin_attr(&attr, chunks[i].node);
+            pthread_create(threads + i, &attr, whip_chunk, chunks + i);
+            pthread_attr_destroy(&attr);
+         }
+         // Write thread output in stream order.
+         for (i = 0 ; i < nthreads ; i++) {
+            pthread_join(threads[i], NULL);
+            fclose(chunks[i].outf);
+            fwrite(chunks[i].out, 1, chunks[i].outlen, outf);
+            free(chunks[i].out);
+         }
+      }
+
+      memmove(buf, buf + end, filled - end);
+      filled -= end;
+      offset += end;
+
+      if (eof && filled == 0) break;
+
+   }
+
+   free(buf);
+   return offset;
+
+}
+
+
+void profile_trie(const char *trainfname, const char *proffname) {
+// Set the edge hits of the trie from a training run over the sample
+// in 'trainfname' (saved to 'proffname' if not NULL) or from a profile
+// previously saved to 'proffname'.
+
+   if (trainfname == NULL) {
+      FILE *proff = fopen(proffname, "r");
+      if (proff == NULL || !rt_load_profile(proff, roots[0])) {
+         fprintf(stderr, "cannot read profile %s\n", proffname);
+         exit(EXIT_FAILURE);
+      }
+      fclose(proff);
+      return;
+   }
+
+   FILE *trainf = fopen(trainfname, "r");
+   if (trainf == NULL) {
+      fprintf(stderr, "cannot open training file %s\n", trainfname);
+      exit(EXIT_FAILURE);
+   }
+
+   char *buf = (char *) malloc(BLOCK_SIZE * sizeof(char));
+   if (buf == NULL) exit_memory_failure();
+
+   size_t filled = 0;
+   size_t end;
+   do {
+      filled += fread(buf + filled, 1, BLOCK_SIZE - filled, trainf);
+      // Cut on the last newline, unless there is none.
+      for (end = filled ; end > 0 && buf[end-1] != '\n' ; end--);
+      if (end == 0 || feof(trainf)) end = filled;
+      rt_profile_buf(buf, end, roots[0]);
+      memmove(buf, buf + end, filled - end);
+      filled -= end;
+   }
+   while (!feof(trainf) && !ferror(trainf));
+
+   free(buf);
+   fclose(trainf);
+
+   if (proffname != NULL) {
+      FILE *proff = fopen(proffname, "w");
+      if (proff == NULL || !rt_save_profile(proff, roots[0])) {
+         fprintf(stderr, "cannot write profile %s\n", proffname);
+         exit(EXIT_FAILURE);
+      }
+      fclose(proff);
+   }
+
+}
+
+
+void select_engine(int p, engine_type engine, int layout, int verbose) {
+// Choose how the keys of pass 'p' are found. Unless forced, the skip
+// engine is used for few long keys, the hash table for keys of a
+// single length (except if the trie has a layout option), and the
+// trie otherwise. Between the skip engine and the hash table, the
+// skip engine wins unless the keys use few characters (e.g. DNA), in
+// which case the shifts are short. Exact keys only.
+
+   skip_table *skip = match_fn == rt_match_buf ? skip_build(roots[p]) : NULL;
+   const size_t nkeys = skip == NULL ? 0 : skip->nkeys;
+   const size_t minlen = skip == NULL ? 0 : skip->minlen;
+   const int nused = skip == NULL ? 0 : skip->nused;
+   const int few_long = skip != NULL && nkeys <= SKIP_AUTO_MAX_KEYS &&
+      minlen >= SKIP_AUTO_MIN_LENGTH;
+
+   if (engine == AUTO_ENGINE && few_long &&
+         (nused >= SKIP_AUTO_MIN_ALPHABET || layout)) {
+      engine = SKIP_ENGINE;
+   }
+
+   if (match_fn == rt_match_buf && (engine == HASH_ENGINE ||
+            (engine == AUTO_ENGINE && !layout))) {
+      // Keys of a single length are found with a hash table.
+      tables[p] = fixed_build(roots[p]);
+      if (tables[p] != NULL) engine = HASH_ENGINE;
+      else if (engine == HASH_ENGINE) {
+         fprintf(stderr, "--engine hash requires keys of a single "
+               "length\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (engine == AUTO_ENGINE && few_long) engine = SKIP_ENGINE;
+
+   if (engine == SKIP_ENGINE) skips[p] = skip;
+   else free(skip);
+   // Without keys, there is nothing to skip to.
+   if (engine == SKIP_ENGINE && skip == NULL) engine = TRIE_ENGINE;
+   if (engine == AUTO_ENGINE) engine = TRIE_ENGINE;
+
+   if (verbose) {
+      fprintf(stderr, "key file %d: %s engine", p+1, ENGINE_NAMES[engine]);
+      if (nkeys > 0) {
+         fprintf(stderr, " (%zu keys, shortest %zu, %d characters)",
+               nkeys, minlen, nused);
+      }
+      fprintf(stderr, "\n");
+   }
+
+}
+
+
+void print_placement(int p, rt_node *root, size_t size, int hugepages) {
+// Report the memory used by the trie of pass 'p'.
+
+   if (size == 0) {
+      fprintf(stderr, "trie %d: not frozen\n", p);
+      return;
+   }
+   fprintf(stderr, "trie %d: %zu bytes", p, size);
+   if (hugepages) {
+      long kb = huge_pages_kb(root);
+      if (kb < 0) fprintf(stderr, ", huge pages: unknown");
+      else fprintf(stderr, ", %ld kB on huge pages", kb);
+   }
+   fprintf(stderr, "\n");
+
+}
+
+
+void print_counts(FILE *outf, const array_lookup *lookup,
+      const long *counts) {
+// Write the keys that matched at least once with their count.
+
+   char key[LOOKUP_MAX_KEY];
+   int i;
+   for (i = 0 ; i < lookup->item_nb ; i++) {
+      if (counts[i] == 0) continue;
+      lookup_key(lookup, i, key);
+      fprintf(outf, "%s\t%ld\n", key, counts[i]);
+   }
+
+}
+
+
+size_t whip_interactive(FILE *streamf, FILE *outf, chunk *c) {
+// Low-latency mode: process the bytes as soon as 'read' returns them
+// and flush the output. Only the bytes that could still be the start
+// of a longer match are held back until more input arrives.
+
+   size_t bufsize = BLOCK_SIZE;
+   size_t filled = 0;
+   ssize_t nread;
+   char *buf = (char *) malloc(bufsize * sizeof(char));
+   if (buf == NULL) exit_memory_failure();
+
+   c->buf = buf;
+   c->offset = 0;
+   c->outf = outf;
+
+   do {
+      if (filled == bufsize) {
+         // Undecided match as long as the buffer: make room.
+         bufsize *= 2;
+         buf = (char *) realloc(buf, bufsize * sizeof(char));
+         if (buf == NULL) exit_memory_failure();
+         c->buf = buf;
+      }
+      nread = read(fileno(streamf), buf + filled, bufsize - filled);
+      if (nread < 0) {
+         fprintf(stderr, "read error\n");
+         exit(EXIT_FAILURE);
+      }
+      filled += nread;
+      // At the end of the stream every match is decided.
+      c->len = filled;
+      c->hold = nread > 0;
+      if (npasses > 1 && c->hold) {
+         // The passes after the first see complete lines only.
+         while (c->len > 0 && buf[c->len-1] != '\n') c->len--;
+         c->hold = 0;
+      }
+      whip_chunk(c);
+      fflush(outf);
+      memmove(buf, buf + c->done, filled - c->done);
+      filled -= c->done;
+      c->offset += c->done;
+   }
+   while (nread > 0);
+
+   free(buf);
+   return c->offset;
+
+}
+
+
+int main (int argc, char *argv[]) {
+
+   char *USAGE = "\n"
+"radixtrie: multiple stream replacement\n\n"
+"USAGE:\n"
+"   radixtrie [options] keyfile [targetfile [outfile]]\n"
+"   radixtrie [options] -k keyfile [-k keyfile ...] [targetfile [outfile]]\n\n"
+"OPTIONS:\n"
+"   -k --keys file        : apply the key files in turn, as a pipeline\n"
+"                           of radixtrie calls would, in a single pass\n"
+"   -c --count            : output the number of matches per key\n"
+"   -p --positions[=fmt]  : output key id, byte offset and length of\n"
+"                           every match ('tsv' (default) or 'bin')\n"
+"   -t --threads n        : number of threads (default 1)\n"
+"   -l --line-buffered    : process input as soon as it is available\n"
+"                           and flush output (for interactive pipes)\n"
+"   -m --mem-limit size   : keep the key set on disk, split by first\n"
+"                           character, and keep at most 'size' bytes\n"
+"                           of it in memory (e.g. 512M, 4G)\n"
+"   --iupac               : IUPAC codes in keys (e.g. 'N', 'R') match\n"
+"                           any of the bases they stand for\n"
+"   --engine name         : 'trie', 'hash' (keys of a single length),\n"
+"                           'skip' (few long keys) or 'auto' (default)\n"
+"   -v --verbose          : print the engine chosen for every key file\n"
+"   --mismatches d        : keys match with up to 'd' substitutions,\n"
+"                           the closest key wins and ties match none\n"
+"   --hugepages           : place the trie on 2 MB pages\n"
+"   --numa                : one copy of the trie per NUMA node, with\n"
+"                           the threads pinned to their node\n"
+"   --stats               : print memory placement and TLB statistics\n"
+"   --train file          : record edge frequencies over a sample input\n"
+"                           and lay out the trie for it\n"
+"   --profile file        : save the frequencies of '--train' to 'file',\n"
+"                           or lay out the trie from 'file' otherwise\n\n";
+
+   static struct option long_options[] = {
+      {"keys",      required_argument, 0, 'k'},
+      {"count",     no_argument,       0, 'c'},
+      {"positions", optional_argument, 0, 'p'},
+      {"threads",   required_argument, 0, 't'},
+      {"line-buffered", no_argument,   0, 'l'},
+      {"mem-limit", required_argument, 0, 'm'},
+      {"iupac",     no_argument,       0, 'I'},
+      {"engine",    required_argument, 0, 'E'},
+      {"verbose",   no_argument,       0, 'v'},
+      {"mismatches", required_argument, 0, 'D'},
+      {"hugepages", no_argument,       0, 'H'},
+      {"numa",      no_argument,       0, 'N'},
+      {"stats",     no_argument,       0, 'S'},
+      {"train",     required_argument, 0, 'T'},
+      {"profile",   required_argument, 0, 'P'},
+      {"help",      no_argument,       0, 'h'},
+      {0, 0, 0, 0}
+   };
+
+   char *keyfnames[MAX_PASSES];
+   int nthreads = 1;
+   int line_buffered = 0;
+   int hugepages = 0;
+   int numa = 0;
+   int stats = 0;
+   int mismatches = 0;
+   engine_type engine = AUTO_ENGINE;
+   int verbose = 0;
+   size_t mem_limit = 0;
+   char *trainfname = NULL;
+   char *proffname = NULL;
+   int c;
+
+  /* Options and arguments processing. */
+
+   while ((c = getopt_long(argc, argv, "k:cp::t:lm:vh",
+               long_options, NULL)) != -1) {
+      switch (c) {
+         case 'k':
+            if (npasses == MAX_PASSES) {
+               fprintf(stderr, "at most %d key files\n", MAX_PASSES);
+               exit(EXIT_FAILURE);
+            }
+            keyfnames[npasses++] = optarg;
+            break;
+         case 'c':
+            mode = COUNT;
+            break;
+         case 'p':
+            if (optarg == NULL || strcmp(optarg, "tsv") == 0) {
+               mode = POSITIONS_TSV;
+            }
+            else if (strcmp(optarg, "bin") == 0) {
+               mode = POSITIONS_BIN;
+            }
+            else {
+               fprintf(stderr, "unknown positions format %s\n", optarg);
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case 't':
+            nthreads = atoi(optarg);
+            if (nthreads < 1 || nthreads > MAX_THREADS) {
+               fprintf(stderr, "threads must be between 1 and %d\n",
+                     MAX_THREADS);
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case 'l':
+            line_buffered = 1;
+            break;
+         case 'm':
+            mem_limit = parse_mem_size(optarg);
+            if (mem_limit == 0) {
+               fprintf(stderr, "invalid memory limit %s\n", optarg);
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case 'I':
+            match_fn = rt_match_iupac;
+            break;
+         case 'E':
+            for (engine = AUTO_ENGINE ; engine <= SKIP_ENGINE ; engine++) {
+               if (strcmp(optarg, ENGINE_NAMES[engine]) == 0) break;
+            }
+            if (engine > SKIP_ENGINE) {
+               fprintf(stderr, "unknown engine %s\n", optarg);
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case 'v':
+            verbose = 1;
+            break;
+         case 'D':
+            mismatches = atoi(optarg);
+            if (mismatches < 0 || (mismatches == 0 && strcmp(optarg, "0"))) {
+               fprintf(stderr, "invalid number of mismatches %s\n", optarg);
+               exit(EXIT_FAILURE);
+            }
+            break;
+         case 'H':
+            hugepages = 1;
+            break;
+         case 'N':
+            numa = 1;
+            break;
+         case 'S':
+            stats = 1;
+            break;
+         case 'T':
+            trainfname = optarg;
+            break;
+         case 'P':
+            proffname = optarg;
+            break;
+         case 'h':
+            fprintf(stdout, "%s", USAGE);
+            exit(EXIT_SUCCESS);
+         default:
+            fprintf(stderr, "%s", USAGE);
+            exit(EXIT_FAILURE);
+      }
+   }
+
+   if (line_buffered && nthreads > 1) {
+      fprintf(stderr, "--line-buffered requires a single thread\n");
+      exit(EXIT_FAILURE);
+   }
+
+   if (mem_limit > 0 && nthreads > 1) {
+      fprintf(stderr, "--mem-limit requires a single thread\n");
+      exit(EXIT_FAILURE);
+   }
+
+   if (mem_limit > 0 && (trainfname != NULL || proffname != NULL ||
+            hugepages || numa)) {
+      fprintf(stderr, "--mem-limit cannot be used with a profile, "
+            "--hugepages or --numa\n");
+      exit(EXIT_FAILURE);
+   }
+
+   if (match_fn == rt_match_iupac &&
+         (mem_limit > 0 || trainfname != NULL || proffname != NULL)) {
+      fprintf(stderr, "--iupac cannot be used with --mem-limit "
+            "or a profile\n");
+      exit(EXIT_FAILURE);
+   }
+
+   if (mismatches > 0 && (match_fn == rt_match_iupac || mem_limit > 0)) {
+      fprintf(stderr, "--mismatches cannot be used with --iupac "
+            "or --mem-limit\n");
+      exit(EXIT_FAILURE);
+   }
+
+   if ((engine == HASH_ENGINE || engine == SKIP_ENGINE) &&
+         (match_fn == rt_match_iupac || mismatches > 0 || mem_limit > 0)) {
+      fprintf(stderr, "--engine %s cannot be used with --iupac, "
+            "--mismatches or --mem-limit\n", ENGINE_NAMES[engine]);
+      exit(EXIT_FAILURE);
+   }
+
+   if (mismatches > 0) {
+      rt_set_mismatches(mismatches);
+      match_fn = rt_match_hamming;
+   }
+
+   // Without '-k', the key file is the first argument.
+   if (npasses == 0 && optind < argc) keyfnames[npasses++] = argv[optind++];
+
+   if (npasses == 0 || argc - optind > 2) {
+      fprintf(stderr, "%s", USAGE);
+      exit(EXIT_FAILURE);
+   }
+
+   if (npasses > 1 && (mem_limit > 0 || trainfname != NULL ||
+            proffname != NULL || mode == POSITIONS_TSV ||
+            mode == POSITIONS_BIN)) {
+      fprintf(stderr, "--mem-limit, --positions and profiles require "
+            "a single key file\n");
+      exit(EXIT_FAILURE);
+   }
+
+   char *fname = argc - optind > 0 ? argv[optind] : NULL;
+   char *outfname = argc - optind > 1 ? argv[optind+1] : NULL;
+
+   FILE *keyf[MAX_PASSES];
+   FILE *streamf = (fname == NULL) ? stdin : fopen(fname, "r");
+   FILE *outf = (outfname == NULL) ? stdout : fopen(outfname, "w");
+
+   int p;
+   for (p = 0 ; p < npasses ; p++) {
+      keyf[p] = fopen(keyfnames[p], "r");
+      if (keyf[p] == NULL) {
+         fprintf(stderr, "cannot open key file %s\n", keyfnames[p]);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (streamf == NULL) {
+      fprintf(stderr, "cannot open stream %s\n", fname);
+      exit(EXIT_FAILURE);
+   }
+
+   if (outf == NULL) {
+      fprintf(stderr, "cannot open file %s for writing\n", outfname);
+      exit(EXIT_FAILURE);
+   }
+
+  /* (End of option parsing). */
+
+   size_t sizes[MAX_PASSES] = {0};
+   char *pools[MAX_PASSES] = {NULL};
+   array_lookup lookup = { .item_nb = 0, .keys = NULL, .blocks = NULL,
+      .values = NULL, .pool = NULL };
+   char key[LOOKUP_MAX_KEY];
+   int item_nb;
+   int i;
+
+   if (mem_limit > 0) {
+      // Leave the keys on disk, only the shard index is resident.
+      shards = create_shard_index(keyf[0], mem_limit);
+      item_nb = shards->item_nb;
+   }
+   else for (p = 0 ; p < npasses ; p++) {
+      // Keep the keys of the last pass for the counts.
+      if (p > 0) dealloc_array_lookup_keys(&lookup);
+      lookup = generate_array_lookup_from_file(keyf[p]);
+      item_nb = lookup.item_nb;
+      roots[p] = create_orphan_node("", NULL);
+      for (i = 0 ; i < lookup.item_nb ; i++) {
+         lookup_key(&lookup, i, key);
+         // Lines with no key are ignored.
+         if (key[0] == '\0') continue;
+         add_key(roots[p], key, lookup_value(&lookup, i), i);
+      }
+      if (trainfname != NULL || proffname != NULL) {
+         profile_trie(trainfname, proffname);
+      }
+      const int layout = trainfname != NULL || proffname != NULL ||
+         hugepages || numa;
+      if (layout) {
+         roots[p] = rt_freeze(roots[p], hugepages ? huge_alloc : malloc,
+               sizes + p);
+      }
+      // The tail nodes point to the values in 'lookup.pool', which
+      // are copied in the block of a frozen trie.
+      pools[p] = sizes[p] == 0 ? lookup.pool : NULL;
+      if (sizes[p] > 0) {
+         free(lookup.pool);
+         lookup.pool = NULL;
+      }
+      if (mode != COUNT) dealloc_array_lookup_keys(&lookup);
+      select_engine(p, engine, layout, verbose);
+      if (match_fn == rt_match_iupac) rt_sort_iupac(roots[p]);
+      if (mismatches > 0) {
+         indexes[p] = hm_build_index(roots[p], mismatches);
+         if (verbose && indexes[p] != NULL) {
+            fprintf(stderr, "key file %d: mismatch index (%d segment "
+                  "positions)\n", p+1, indexes[p]->nprobes);
+         }
+         else if (verbose) {
+            fprintf(stderr, "key file %d: no mismatch index (keys of at "
+                  "most %d characters or more than %d segment positions), "
+                  "the trie is searched at every position\n", p+1,
+                  mismatches, MAX_PROBES);
+         }
+      }
+   }
+
+   int nnodes = numa ? numa_node_count() : 1;
+   for (i = 0 ; numa && i < nnodes ; i++) {
+      // Copy the tries on every node, keep the original if it fails.
+      // Only the tries are copied: the hash, skip and mismatch tables
+      // stay on the node that built them and point to its trie.
+      for (p = 0 ; p < npasses ; p++) {
+         replicas[i][p] = sizes[p] == 0 ? NULL : numa_replicate(roots[p],
+               sizes[p], i, hugepages ? huge_alloc : malloc);
+         if (replicas[i][p] == NULL) replicas[i][p] = roots[p];
+      }
+   }
+
+   // One chunk per thread, each with its own counts.
+   chunk chunks[MAX_THREADS];
+   for (i = 0 ; i < nthreads ; i++) {
+      chunks[i].hold = 0;
+      chunks[i].roots = numa ? replicas[i % nnodes] : roots;
+      chunks[i].node = numa ? i % nnodes : -1;
+      chunks[i].counts = NULL;
+      if (mode != COUNT) continue;
+      chunks[i].counts = (long *) calloc(item_nb, sizeof(long));
+      if (chunks[i].counts == NULL) exit_memory_failure();
+   }
+
+   int tlbfd = stats ? tlb_counter_open() : -1;
+   size_t total = line_buffered ?
+      whip_interactive(streamf, outf, chunks) :
+      whip_stream(streamf, outf, chunks, nthreads);
+
+   if (stats) {
+      for (p = 0 ; p < npasses ; p++) print_placement(p, roots[p], sizes[p],
+            hugepages);
+      if (numa) {
+         fprintf(stderr, "numa: %d node(s), one copy of the trie per "
+               "node, threads pinned to their node\n", nnodes);
+      }
+      long long misses = tlb_counter_read(tlbfd);
+      if (misses < 0) fprintf(stderr, "dTLB load misses: not available\n");
+      else fprintf(stderr, "dTLB load misses: %lld (%.3f per kB of input)\n",
+            misses, total == 0 ? 0.0 : 1024.0 * misses / total);
+   }
+
+   if (mode == COUNT) {
+      // Merge the counts of all threads.
+      int j;
+      for (i = 1 ; i < nthreads ; i++) {
+         for (j = 0 ; j < item_nb ; j++) {
+            chunks[0].counts[j] += chunks[i].counts[j];
+         }
+         free(chunks[i].counts);
+      }
+      if (shards == NULL) {
+         print_counts(outf, &lookup, chunks[0].counts);
+      }
+      else {
+         // Read back the keys of the shards one at a time.
+         for (i = 0 ; i < shards->shard_nb ; i++) {
+            lookup = load_shard_lookup(shards, i);
+            print_counts(outf, &lookup,
+                  chunks[0].counts + shards->shards[i].base);
+            dealloc_array_lookup(&lookup);
+         }
+      }
+      free(chunks[0].counts);
+   }
+
+   if (shards != NULL) destroy_shard_index(shards);
+   else dealloc_array_lookup_keys(&lookup);
+   for (p = 0 ; p < npasses ; p++) free(pools[p]);
+
+  /* Wrap up. */
+   fflush(outf);
+   for (p = 0 ; p < npasses ; p++) fclose(keyf[p]);
+   fclose(streamf);
+   fclose(outf);
+
+   exit(EXIT_SUCCESS);
+
+}
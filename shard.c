@@ -0,0 +1,503 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include "shard.h"
+
+/*
+Sharded key sets. The key file is split on disk by prefix: first on
+the first character, then every group of keys too large for a shard
+is split again on the character that follows the longest prefix
+common to its keys, until every shard fits in a fraction of the
+memory limit. A key equal to the prefix of a split group (a
+'residual' key) is kept in memory in the prefix tree. The
+trie of every shard is built once and frozen at an address reserved
+for the shard, then written to an image file, which is mapped at the
+same address. The image is used as is: only the pages that are
+visited are read, and the pages of the least recently used shards
+are dropped to keep under the memory limit. The shard directory is
+removed at exit, also on errors and on fatal signals, since it holds
+a copy of a key set that may be larger than memory.
+*/
+
+// Shard directory to remove at exit, empty if none.
+static char cleanup_dir[256];
+
+// Key buffer of the shard builders, which are called from the
+// recursion of 'split_keys()' and must keep its frames small.
+static char key[LOOKUP_MAX_KEY];
+
+static void exit_shard_failure(const char *msg, const char *s) {
+   fprintf(stderr, "%s %s\n", msg, s);
+   exit(EXIT_FAILURE);
+}
+
+
+static void remove_shard_dir(void) {
+// Remove the shard directory and the files in it.
+
+   if (cleanup_dir[0] == '\0') return;
+
+   DIR *dir = opendir(cleanup_dir);
+   struct dirent *entry;
+   char path[sizeof(cleanup_dir) + 256];
+   while (dir != NULL && (entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] == '.') continue;
+      snprintf(path, sizeof(path), "%s/%s", cleanup_dir, entry->d_name);
+      unlink(path);
+   }
+   if (dir != NULL) closedir(dir);
+   rmdir(cleanup_dir);
+   cleanup_dir[0] = '\0';
+
+}
+
+
+static void remove_shard_dir_on_signal(int sig) {
+// Remove the shard directory, then die of the signal.
+
+   remove_shard_dir();
+   signal(sig, SIG_DFL);
+   raise(sig);
+
+}
+
+
+size_t parse_mem_size(const char *s) {
+// Parse a memory size such as '512M' or '4G' (powers of 1024).
+// Return 0 if 's' is not a valid size.
+
+   char *end;
+   size_t size = strtoull(s, &end, 10);
+
+   switch (*end) {
+      case 'g': case 'G': size <<= 10;
+      case 'm': case 'M': size <<= 10;
+      case 'k': case 'K': size <<= 10; end++;
+      case '\0': break;
+      default: return 0;
+   }
+
+   return *end == '\0' ? size : 0;
+
+}
+
+
+static void shard_path(char *path, const shard_index *idx, int k) {
+   sprintf(path, "%s/%d", idx->dir, k);
+}
+
+static void image_path(char *path, const shard_index *idx, int k) {
+   sprintf(path, "%s/%d.img", idx->dir, k);
+}
+
+static void split_path(char *path, const shard_index *idx, size_t depth,
+      int b) {
+   sprintf(path, "%s/split.%zu.%02x", idx->dir, depth, b);
+}
+
+
+static size_t shard_footprint(size_t bytes, int item_nb) {
+// Estimate the memory used by the trie of a shard. Every key adds at
+// most a leaf and an internal node, with their 'children' slots.
+
+   return bytes + item_nb * (2 * sizeof(rt_node) + 4 * sizeof(void *));
+
+}
+
+
+static int new_shard(shard_index *idx, int item_nb) {
+// Add a shard with the next 'item_nb' key ids, return its index.
+
+   if ((idx->shard_nb & (idx->shard_nb - 1)) == 0) {
+      // Grow the array when the count reaches a power of 2.
+      size_t nb = idx->shard_nb == 0 ? 16 : 2 * idx->shard_nb;
+      idx->shards = (rt_shard *) realloc(idx->shards, nb * sizeof(rt_shard));
+      if (idx->shards == NULL) exit_shard_failure("memory error", "");
+   }
+
+   rt_shard *s = idx->shards + idx->shard_nb;
+   s->item_nb = item_nb;
+   s->base = idx->item_nb;
+   s->size = 0;
+   s->addr = NULL;
+   s->root = NULL;
+   s->last_use = 0;
+   idx->item_nb += item_nb;
+
+   return idx->shard_nb++;
+
+}
+
+
+array_lookup load_shard_lookup(shard_index *idx, int k) {
+// Read the keys of shard 'k' from disk.
+
+   char path[sizeof(idx->dir) + 32];
+   shard_path(path, idx, k);
+
+   FILE *f = fopen(path, "r");
+   if (f == NULL) exit_shard_failure("cannot open shard file", path);
+   array_lookup lookup = generate_array_lookup_from_file(f);
+   fclose(f);
+
+   return lookup;
+
+}
+
+
+static void *image_alloc(size_t size) {
+// Allocator of 'rt_freeze()' for the images: whole pages at an
+// address that stays reserved for the shard.
+
+   void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   return addr == MAP_FAILED ? NULL : addr;
+
+}
+
+
+static void map_image(shard_index *idx, int k) {
+// Replace the memory of the image of shard 'k' by a read-only mapping
+// of its file at the same address. The pages are read when visited.
+
+   rt_shard *s = idx->shards + k;
+   char path[sizeof(idx->dir) + 32];
+   image_path(path, idx, k);
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) exit_shard_failure("cannot open shard file", path);
+   void *map = mmap(s->addr, s->size, PROT_READ, MAP_FIXED | MAP_SHARED,
+         fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) exit_shard_failure("cannot map shard file", path);
+
+}
+
+
+static void compile_shard(shard_index *idx, int k) {
+// Build the trie of shard 'k' and write it to its image file.
+
+   rt_shard *s = idx->shards + k;
+   array_lookup lookup = load_shard_lookup(idx, k);
+   int i;
+
+   rt_node *root = create_orphan_node("", NULL);
+   for (i = 0 ; i < lookup.item_nb ; i++) {
+      lookup_key(&lookup, i, key);
+      add_key(root, key, lookup_value(&lookup, i), s->base + i);
+   }
+   s->addr = rt_freeze(root, image_alloc, &s->size);
+   if (s->size == 0) exit_shard_failure("memory error", "");
+   dealloc_array_lookup(&lookup);
+
+   char path[sizeof(idx->dir) + 32];
+   image_path(path, idx, k);
+   FILE *f = fopen(path, "w");
+   if (f == NULL) exit_shard_failure("cannot open shard file", path);
+   if (fwrite(s->addr, 1, s->size, f) != s->size || fclose(f) != 0) {
+      exit_shard_failure("cannot write shard file", path);
+   }
+   map_image(idx, k);
+
+}
+
+
+static rt_node *load_residual(shard_index *idx, int k) {
+// Return a tail node for the key of shard 'k', which is the prefix of
+// a split group ('NULL' for a line with no key).
+
+   array_lookup lookup = load_shard_lookup(idx, k);
+   rt_node *node = NULL;
+
+   lookup_key(&lookup, 0, key);
+   if (key[0] != '\0') {
+      char *value = strdup(lookup_value(&lookup, 0));
+      if (value == NULL) exit_shard_failure("memory error", "");
+      node = create_orphan_node("", value);
+      node->keyid = idx->shards[k].base;
+   }
+   dealloc_array_lookup(&lookup);
+
+   return node;
+
+}
+
+
+typedef
+struct
+/*********************************************************************
+  Group of lines of 'split_keys()' with the same character at the
+  split depth.
+    'f'      : split file of the group, 'NULL' if the group is empty
+    'first'  : first line of the group
+    'common' : length of the key prefix common to the group
+    'bytes'  : size of the lines
+    'item_nb': number of lines
+*********************************************************************/
+{
+   FILE     *f;
+   char     *first;
+   size_t    common;
+   size_t    bytes;
+   int       item_nb;
+}
+split_group;
+
+
+static shard_dir *split_keys(shard_index *idx, FILE *f, size_t depth) {
+// Split the lines of 'f', which share their first 'depth' characters,
+// on the character at 'depth'. Groups are visited in byte order, so
+// that the shards follow the order of the keys. A group that is split
+// again skips the prefix common to its keys, so that a long common
+// prefix does not cost one pass over the keys per character.
+
+   shard_dir *d = (shard_dir *) calloc(1, sizeof(shard_dir));
+   if (d == NULL) exit_shard_failure("memory error", "");
+   d->shard = -1;
+   d->children = (shard_dir **) calloc(SHARD_NB, sizeof(shard_dir *));
+   if (d->children == NULL) exit_shard_failure("memory error", "");
+
+   // Per group, on the heap: a chain of keys that are prefixes of each
+   // other recurses once per key.
+   split_group *g = (split_group *) calloc(SHARD_NB, sizeof(split_group));
+   if (g == NULL) exit_shard_failure("memory error", "");
+   char path[sizeof(idx->dir) + 32];
+   char dest[sizeof(idx->dir) + 32];
+   char *line = NULL;
+   size_t cap = 0;
+   ssize_t len;
+   size_t j;
+   int b;
+
+   while ((len = getline(&line, &cap, f)) > 0) {
+      char *tab = strchr(line, '\t');
+      if (tab == NULL) {
+         exit_shard_failure("character separator not found in line", line);
+      }
+      // The first 'depth' characters are not '\t', so 'line[depth]' is
+      // at most the separator.
+      b = (unsigned char) line[depth];
+      if (g[b].f == NULL) {
+         split_path(path, idx, depth, b);
+         g[b].f = fopen(path, "w");
+         if (g[b].f == NULL) {
+            exit_shard_failure("cannot open shard file", path);
+         }
+         g[b].first = strdup(line);
+         if (g[b].first == NULL) exit_shard_failure("memory error", "");
+         g[b].common = tab - line;
+      }
+      // Length of the key prefix common to the group.
+      for (j = depth ; j < g[b].common && line[j] == g[b].first[j] ; j++);
+      g[b].common = j;
+      fputs(line, g[b].f);
+      if (line[len-1] != '\n') fputc('\n', g[b].f);
+      g[b].bytes += len;
+      g[b].item_nb++;
+   }
+   free(line);
+
+   // Close every group before any recursion, which opens its own.
+   for (b = 0 ; b < SHARD_NB ; b++) {
+      if (g[b].f != NULL && fclose(g[b].f) != 0) {
+         exit_shard_failure("cannot write shard file", idx->dir);
+      }
+   }
+
+   for (b = 0 ; b < SHARD_NB ; b++) {
+      if (g[b].item_nb == 0) continue;
+      split_path(path, idx, depth, b);
+      if (b == '\t') {
+         // The key is the prefix (duplicates are reported here).
+         int k = new_shard(idx, g[b].item_nb);
+         shard_path(dest, idx, k);
+         rename(path, dest);
+         d->residual = load_residual(idx, k);
+      }
+      else if (g[b].item_nb > 1 && shard_footprint(g[b].bytes,
+               g[b].item_nb) > idx->mem_limit / SHARD_SPLIT) {
+         FILE *sub = fopen(path, "r");
+         if (sub == NULL) exit_shard_failure("cannot open shard file", path);
+         // Split after the common prefix ('common > depth' since the
+         // keys share the character at 'depth').
+         d->children[b] = split_keys(idx, sub, g[b].common);
+         fclose(sub);
+         unlink(path);
+         d->children[b]->skip = strndup(g[b].first + depth+1,
+               g[b].common - depth-1);
+         if (d->children[b]->skip == NULL) {
+            exit_shard_failure("memory error", "");
+         }
+      }
+      else {
+         shard_dir *leaf = (shard_dir *) calloc(1, sizeof(shard_dir));
+         if (leaf == NULL) exit_shard_failure("memory error", "");
+         leaf->shard = new_shard(idx, g[b].item_nb);
+         shard_path(dest, idx, leaf->shard);
+         rename(path, dest);
+         compile_shard(idx, leaf->shard);
+         d->children[b] = leaf;
+      }
+      free(g[b].first);
+   }
+   free(g);
+
+   return d;
+
+}
+
+
+shard_index *create_shard_index(FILE *keyf, size_t mem_limit) {
+// Split the key file in shards and compile them. Keys are not loaded
+// in memory all at once, so this works for any key set size.
+
+   shard_index *idx = (shard_index *) calloc(1, sizeof(shard_index));
+   if (idx == NULL) exit_shard_failure("memory error", "");
+
+   const char *tmpdir = getenv("TMPDIR");
+   snprintf(idx->dir, sizeof(idx->dir), "%s/whiplace.XXXXXX",
+         tmpdir == NULL ? "/tmp" : tmpdir);
+   if (mkdtemp(idx->dir) == NULL) {
+      exit_shard_failure("cannot create shard directory", idx->dir);
+   }
+
+   strcpy(cleanup_dir, idx->dir);
+   atexit(remove_shard_dir);
+   signal(SIGINT, remove_shard_dir_on_signal);
+   signal(SIGTERM, remove_shard_dir_on_signal);
+   signal(SIGHUP, remove_shard_dir_on_signal);
+   signal(SIGPIPE, remove_shard_dir_on_signal);
+
+   idx->mem_limit = mem_limit;
+
+   rewind(keyf);
+   idx->top = split_keys(idx, keyf, 0);
+
+   return idx;
+
+}
+
+
+static void evict_shard(shard_index *idx, rt_shard *s) {
+// Drop the pages of the image from memory (they are read again from
+// the file if needed).
+
+   madvise(s->addr, s->size, MADV_DONTNEED);
+   s->root = NULL;
+   idx->resident -= s->size;
+
+}
+
+
+static rt_node *shard_root(shard_index *idx, int k) {
+// Return the trie of shard 'k'. Its image counts as resident from
+// now, and the pages of the least recently used shards are dropped to
+// stay under the memory limit.
+
+   rt_shard *s = idx->shards + k;
+   s->last_use = ++idx->clock;
+   if (s->root != NULL) return s->root;
+
+   s->root = (rt_node *) s->addr;
+   idx->resident += s->size;
+
+   while (idx->resident > idx->mem_limit) {
+      rt_shard *lru = NULL;
+      int i;
+      for (i = 0 ; i < idx->shard_nb ; i++) {
+         rt_shard *t = idx->shards + i;
+         if (t->root == NULL || t == s) continue;
+         if (lru == NULL || t->last_use < lru->last_use) lru = t;
+      }
+      if (lru == NULL) break;
+      evict_shard(idx, lru);
+   }
+
+   return s->root;
+
+}
+
+
+rt_node *shard_match(shard_index *idx, const char *buf, size_t len,
+      size_t *match_len, int *more) {
+// Same as 'rt_match_buf()' over a sharded key set. Follow the input
+// down the prefix tree, remembering the residual keys on the way, to
+// the shard of the prefix, and match the keys of the shard (which all
+// are longer than the residual keys).
+
+   shard_dir *d = idx->top;
+   rt_node *match = NULL;
+   size_t depth = 0;
+
+   *match_len = 0;
+   *more = 0;
+
+   while (d->shard < 0) {
+      if (d->residual != NULL) {
+         match = d->residual;
+         *match_len = depth;
+      }
+      if (depth >= len) {
+         *more = 1;
+         return match;
+      }
+      d = d->children[(unsigned char) buf[depth++]];
+      if (d == NULL) return match;
+      // The prefix common to the keys under 'd'.
+      const char *skip = d->skip == NULL ? "" : d->skip;
+      for ( ; *skip != '\0' ; skip++, depth++) {
+         if (depth >= len) {
+            *more = 1;
+            return match;
+         }
+         if (buf[depth] != *skip) return match;
+      }
+   }
+
+   size_t shard_len;
+   rt_node *node = rt_match_buf(buf, len, shard_root(idx, d->shard),
+         &shard_len, more);
+   if (node == NULL) return match;
+
+   *match_len = shard_len;
+   return node;
+
+}
+
+
+static void free_dir(shard_dir *d) {
+
+   if (d->children != NULL) {
+      int b;
+      for (b = 0 ; b < SHARD_NB ; b++) {
+         if (d->children[b] != NULL) free_dir(d->children[b]);
+      }
+      free(d->children);
+   }
+   if (d->residual != NULL) {
+      free(d->residual->data);
+      rt_free(d->residual);
+   }
+   free(d->skip);
+   free(d);
+
+}
+
+
+void destroy_shard_index(shard_index *idx) {
+// Unmap the shards and remove the shard files.
+
+   int k;
+   for (k = 0 ; k < idx->shard_nb ; k++) {
+      if (idx->shards[k].addr != NULL) {
+         munmap(idx->shards[k].addr, idx->shards[k].size);
+      }
+   }
+
+   free_dir(idx->top);
+   free(idx->shards);
+   remove_shard_dir();
+   free(idx);
+
+}
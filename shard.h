@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "array_lookup.h"
+#include "radixtrie.h"
+
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#define SHARD_NB 256
+// A shard must fit in this fraction of the memory limit.
+#define SHARD_SPLIT 4
+
+typedef
+struct
+/*********************************************************************
+  Shard of a key set: the keys that start with the same prefix, in a
+  key file (for the counts) and in a compiled trie image (for the
+  matches) on disk.
+    'item_nb' : number of lines in the shard key file
+    'base'    : key id of the first key of the shard
+    'size'    : size of the trie image
+    'addr'    : address of the mapped image, 'NULL' if none
+    'root'    : root of the trie image, 'NULL' if not resident
+    'last_use': clock value of the last lookup (for LRU eviction)
+*********************************************************************/
+{
+   int             item_nb;
+   int             base;
+   size_t          size;
+   void           *addr;
+   rt_node        *root;
+   unsigned long   last_use;
+}
+rt_shard;
+
+typedef
+struct shard_dir
+/*********************************************************************
+  Node of the prefix tree of the shards. A prefix with too many keys
+  for one shard is split on the character after the longest prefix
+  common to its keys.
+    'shard'   : index of the shard of the prefix, -1 if it is split
+    'skip'    : characters common to all the keys of a split node
+                after the character that leads to it, 'NULL' if none
+    'residual': tail node of the key equal to the prefix of a split
+                node (resident), 'NULL' if there is none
+    'children': split nodes per next character, 'NULL' if none
+*********************************************************************/
+{
+   int                 shard;
+   char               *skip;
+   rt_node            *residual;
+   struct shard_dir  **children;
+}
+shard_dir;
+
+typedef
+struct
+/*********************************************************************
+  Resident index of a sharded key set. Only the prefix tree and the
+  residual keys stay in memory, the trie images of the shards in 'dir'
+  are mapped and their pages dropped in LRU order to keep under
+  'mem_limit'. Shards are numbered in key order.
+*********************************************************************/
+{
+   char            dir[256];
+   size_t          mem_limit;
+   size_t          resident;
+   int             item_nb;
+   unsigned long   clock;
+   shard_dir      *top;
+   int             shard_nb;
+   rt_shard       *shards;
+}
+shard_index;
+
+
+shard_index *create_shard_index(FILE *, size_t);
+rt_node *shard_match(shard_index *, const char *, size_t, size_t *, int *);
+array_lookup load_shard_lookup(shard_index *, int);
+void destroy_shard_index(shard_index *);
+size_t parse_mem_size(const char *);
+
+#endif
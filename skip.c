@@ -0,0 +1,128 @@
+#include "skip.h"
+
+/*
+Skip-based scanning (Wu-Manber) for small sets of long keys. A window
+of the length of the shortest key slides over the input, and the last
+2 characters of the window tell how far it can move without missing
+the start of a key (with keys of a single character, the window is the
+character itself). Where the shift is 0 a key may start at the
+window, and the trie is walked there, so the matches are the same
+leftmost-longest matches as with the trie alone.
+*/
+
+
+typedef
+struct
+/*********************************************************************
+  State of the walk over the keys in 'skip_build()'.
+    't'    : table, with its window set in the second walk
+    'used' : 1 for the characters that occur in the keys, 0 otherwise
+*********************************************************************/
+{
+   skip_table   *t;
+   uint8_t       used[256];
+}
+skip_walk;
+
+
+static int visit_key(rt_node *tail, const char *key, size_t len,
+      void *arg) {
+// Count the key, find the shortest one and the characters they use if
+// the shifts are not set yet ('window' is 0), otherwise lower the
+// shifts of the blocks in the first 'window' characters of the key.
+
+   skip_walk *w = (skip_walk *) arg;
+   skip_table *t = w->t;
+   size_t j;
+
+   if (t->window == 0) {
+      for (j = 0 ; j < len ; j++) w->used[(unsigned char) key[j]] = 1;
+      if (t->nkeys == 0 || len < t->minlen) t->minlen = len;
+      t->nkeys++;
+   }
+   else if (t->window == 1) {
+      t->shift[(unsigned char) key[0]] = 0;
+   }
+   else {
+      const size_t m = t->window;
+      for (j = 1 ; j < m ; j++) {
+         const int b = (unsigned char) key[j-1] << 8 |
+            (unsigned char) key[j];
+         if (t->shift[b] > m-1 - j) t->shift[b] = m-1 - j;
+      }
+   }
+
+   return 1;
+
+}
+
+
+skip_table *skip_build(rt_node *root) {
+// Build the shift table of the keys of the trie. Return 'NULL' if
+// there is no key.
+
+   skip_walk w = { NULL, {0} };
+   w.t = (skip_table *) calloc(1, sizeof(skip_table));
+   if (w.t == NULL || !rt_walk_keys(root, visit_key, &w)) {
+      fprintf(stderr, "memory error\n");
+      exit(EXIT_FAILURE);
+   }
+
+   skip_table *t = w.t;
+   if (t->nkeys == 0) {
+      free(t);
+      return NULL;
+   }
+
+   t->window = t->minlen < SKIP_MAX_WINDOW ? t->minlen : SKIP_MAX_WINDOW;
+   memset(t->shift, t->window == 1 ? 1 : t->window - 1, sizeof(t->shift));
+   if (!rt_walk_keys(root, visit_key, &w)) {
+      fprintf(stderr, "memory error\n");
+      exit(EXIT_FAILURE);
+   }
+
+   int c;
+   for (c = 0 ; c < 256 ; c++) t->nused += w.used[c];
+
+   return t;
+
+}
+
+
+rt_node *skip_next(const skip_table *t, const char *buf, size_t len,
+      rt_node *root, size_t *pos, size_t *match_len, int *more) {
+// Return the tail node of the leftmost-longest match in 'buf' at or
+// after '*pos' and set '*pos' to its position. If there is none, return
+// 'NULL' and set '*pos' to 'len', or to the first position where the
+// match is not decided by the characters of the buffer, in which case
+// set '*more'.
+
+   const size_t m = t->window;
+   const unsigned char *u = (const unsigned char *) buf;
+   size_t s = *pos;
+   rt_node *match;
+
+   *match_len = 0;
+   *more = 0;
+
+   while (s + m <= len) {
+      const size_t shift = m == 1 ? t->shift[u[s]] :
+         t->shift[u[s+m-2] << 8 | u[s+m-1]];
+      if (shift > 0) {
+         s += shift;
+         continue;
+      }
+      match = rt_match_buf(buf + s, len - s, root, match_len, more);
+      if (match != NULL || *more) {
+         *pos = s;
+         return match;
+      }
+      s++;
+   }
+
+   // No key fits after 'len - m', but keys that start there may end
+   // beyond the buffer: the trie tells where.
+   *pos = s < len ? s : len;
+   return rt_match_from(buf, len, root, pos, match_len, more);
+
+}
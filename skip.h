@@ -0,0 +1,37 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "radixtrie.h"
+
+#ifndef _SKIP_H
+#define _SKIP_H
+
+#define SKIP_MAX_WINDOW 255
+
+typedef
+struct
+/*********************************************************************
+  Wu-Manber shift table of a key set, on blocks of 2 characters (or
+  of 1 if the shortest key has a single character).
+    'nkeys' : number of keys
+    'minlen': length of the shortest key
+    'window': length of the scanning window ('minlen', at most 255)
+    'nused' : number of different characters in the keys
+    'shift' : safe shift of the window for its last block
+*********************************************************************/
+{
+   size_t     nkeys;
+   size_t     minlen;
+   size_t     window;
+   int        nused;
+   uint8_t    shift[1 << 16];
+}
+skip_table;
+
+
+skip_table *skip_build(rt_node *);
+rt_node *skip_next(const skip_table *, const char *, size_t, rt_node *,
+      size_t *, size_t *, int *);
+
+#endif
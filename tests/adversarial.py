@@ -0,0 +1,618 @@
+#!/usr/bin/env python
+# -*- coding:utf-8 -*-
+
+"""Worst-case and differential harness for the C engines.
+
+Every case (pathological key/input pairs and random fuzz cases) is run
+through 'whiplace.py', which is the reference, and through every engine
+configuration listed in 'ENGINES'. The outputs must be byte-identical.
+The '--count' and '--positions' outputs of 'MATCH_ENGINES' are compared
+to the matches of a reference matcher, itself checked against the
+output of 'whiplace.py'. Degenerate keys are compared to a reference
+IUPAC matcher in 'IUPAC_ENGINES', approximate keys to a reference
+Hamming matcher in 'MISMATCH_ENGINES', and two key files in one call
+to a pipeline of two calls in 'PASS_ENGINES'. Some inputs are also
+written to '--line-buffered' a few bytes at a time through a pipe, and
+prompts (no newline) must come out before the input ends.
+
+With '--timing', the engines are also timed on the pathological cases
+with inputs of growing size. The cost per byte must not grow by more
+than '--bound' when the input grows, otherwise the case fails. Timings
+depend on the load of the machine, so they are not part of the default
+run, which is deterministic.
+
+Invoke as 'python tests/adversarial.py' from the repository root, after
+'make'. The exit status is 1 if any case fails."""
+
+import argparse
+import os
+import random
+import select
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+REFERENCE = [sys.executable, os.path.join(ROOT, 'whiplace.py')]
+
+# Engine configurations to check against the reference. The key file
+# and the input file are appended to the command, '{input}' is replaced
+# by the input file.
+ENGINES = {
+   'trie':       [],
+   'threads':    ['--threads', '4'],
+   'sharded':    ['--mem-limit', '1K'],
+   'profiled':   ['--train', '{input}'],
+   'streaming':  ['--line-buffered'],
+   'placed':     ['--hugepages', '--numa', '--threads', '2'],
+   'skip':       ['--engine', 'skip'],
+}
+
+# Configurations checked in the match-only modes.
+MATCH_ENGINES = ['trie', 'threads', 'sharded', 'skip']
+
+
+def pathological_cases(k):
+   """Yield (name, items, unit) triples where 'unit' repeated gives the
+   input. All of them make a trie walk go 'k' characters deep at every
+   position of the input before failing or backing up."""
+   a = 'a'
+   # 'a', 'aa', ..., 'a^k b' against 'aaaa...'.
+   yield ('prefix-chain',
+         [(a*i, str(i)) for i in range(1, k)] + [(a*k + 'b', 'B')], a)
+   # Only 'a^k b': every walk fails at depth 'k'.
+   yield ('long-miss', [(a*k + 'b', 'B')], a)
+   # Matches that end one character before a longer key.
+   yield ('near-miss',
+         [(a*k, 'X'), (a*k + 'c', 'Y'), (a*(k-1) + 'b', 'Z')],
+         a*(k-1) + 'b')
+   # Many keys sharing a long prefix with a different last character.
+   yield ('wide-tail',
+         [(a*k + chr(c), chr(c).upper()) for c in range(ord('b'), ord('z'))],
+         a*k + '!')
+
+
+def fuzz_case(rng):
+   """Random key set over a small alphabet, with prefixes of other keys
+   or keys of a single length, empty values, values that contain tabs
+   and lines with no key, and a random input."""
+   alphabet = rng.choice(['ab', 'abc', 'acgt', 'ACGT', 'ab \t'])
+   width = rng.choice([None, None, rng.randint(1, 8)])
+   keys = set()
+   for i in range(rng.randint(1, 60)):
+      keys.add(''.join(rng.choice(alphabet.strip('\t') or 'a')
+            for j in range(width or rng.randint(1, 8))))
+   keys = sorted(keys)
+   items = []
+   for key in keys:
+      value = rng.choice(['', key.upper(), '<%s>' % key, 'x\ty'])
+      items.append((key, value))
+   if rng.random() < 0.2:
+      # A line with no key, ignored but counted in the key ids.
+      items.append(('', 'empty'))
+   text = ''.join(rng.choice(alphabet + '\n.')
+         for i in range(rng.randint(0, 3000)))
+   return (items, text)
+
+
+def write_case(workdir, items, text):
+   keyf = os.path.join(workdir, 'keys.txt')
+   inf = os.path.join(workdir, 'input.txt')
+   with open(keyf, 'w') as f:
+      for (key, value) in items:
+         f.write('%s\t%s\n' % (key, value))
+   with open(inf, 'w') as f:
+      f.write(text)
+   return (keyf, inf)
+
+
+def run(cmd):
+   """Run 'cmd' and return (output, seconds)."""
+   start = time.time()
+   proc = subprocess.run(cmd, stdout=subprocess.PIPE,
+         stderr=subprocess.PIPE)
+   elapsed = time.time() - start
+   if proc.returncode != 0:
+      raise RuntimeError('%s failed: %s' %
+            (' '.join(cmd), proc.stderr.decode(errors='replace')))
+   return (proc.stdout, elapsed)
+
+
+def engine_cmd(binary, engine, keyf, inf):
+   args = [arg.format(input=inf) for arg in ENGINES[engine]]
+   return [binary] + args + [keyf, inf]
+
+
+def differential(binary, workdir, name, items, text):
+   """Compare every engine with the reference. Return failure messages
+   and keep the files of failing cases."""
+   (keyf, inf) = write_case(workdir, items, text)
+   (expected, elapsed) = run(REFERENCE + [keyf, inf])
+   failures = []
+   for engine in ENGINES:
+      try:
+         (output, elapsed) = run(engine_cmd(binary, engine, keyf, inf))
+      except RuntimeError as err:
+         failures.append('%s [%s]: %s' % (name, engine, err))
+         continue
+      if output != expected:
+         failures.append('%s [%s]: output differs from reference'
+               % (name, engine))
+   if failures:
+      keep = tempfile.mkdtemp(prefix='whiplace-%s-' % name)
+      shutil.copy(keyf, keep)
+      shutil.copy(inf, keep)
+      failures.append('%s: case saved in %s' % (name, keep))
+   return failures
+
+
+def compare(binary, name, configs, files, expected, against='reference',
+      **fields):
+   """Run every configuration of 'configs' (name -> arguments, in which
+   '{field}' is replaced from 'fields') on 'files' and compare the
+   output with 'expected'. Return failure messages."""
+   failures = []
+   for (engine, args) in configs.items():
+      cmd = [binary] + [arg.format(**fields) for arg in args] + files
+      try:
+         if run(cmd)[0] != expected:
+            failures.append('%s [%s]: output differs from %s'
+                  % (name, engine, against))
+      except RuntimeError as err:
+         failures.append('%s [%s]: %s' % (name, engine, err))
+   return failures
+
+
+def reference_matches(items, text):
+   """Return the (keyid, offset, length) triples of the matches of the
+   keys in 'text', in bytes: the longest key at every position, then
+   the search resumes after the match. Key ids are the indexes of the
+   lines in the sorted key file."""
+   lines = sorted(('%s\t%s' % item).encode() for item in items)
+   keyids = {line.split(b'\t', 1)[0]: i for (i, line) in enumerate(lines)}
+   lengths = sorted({len(key) for key in keyids if key}, reverse=True)
+   data = text.encode()
+   matches = []
+   i = 0
+   while i < len(data):
+      for n in lengths:
+         if i + n <= len(data) and data[i:i+n] in keyids:
+            matches.append((keyids[data[i:i+n]], i, n))
+            i += n
+            break
+      else:
+         i += 1
+   return matches
+
+
+def match_outputs(items, text, expected):
+   """Return the expected outputs of '--count', '--positions' and
+   '--positions=bin', after checking that the matches of
+   'reference_matches()' give the replacement output 'expected'."""
+   matches = reference_matches(items, text)
+   lines = sorted(('%s\t%s' % item).encode() for item in items)
+   (keys, values) = zip(*(line.split(b'\t', 1) for line in lines)) \
+         if lines else ((), ())
+   data = text.encode()
+   (replaced, end, counts) = ([], 0, {})
+   for (keyid, offset, length) in matches:
+      replaced += [data[end:offset], values[keyid]]
+      end = offset + length
+      counts[keyid] = counts.get(keyid, 0) + 1
+   if b''.join(replaced) + data[end:] != expected:
+      raise RuntimeError('reference matches disagree with whiplace.py')
+   return {
+      '--count': b''.join(b'%s\t%d\n' % (keys[keyid], counts[keyid])
+            for keyid in sorted(counts)),
+      '--positions': b''.join(b'%d\t%d\t%d\n' % match
+            for match in matches),
+      '--positions=bin': b''.join(struct.pack('=IIQ', keyid, length,
+            offset) for (keyid, offset, length) in matches),
+   }
+
+
+def match_only(binary, workdir, name, items, text):
+   """Compare the match-only outputs of the engines, with one thread
+   and with several, with the reference. Return failure messages."""
+   (keyf, inf) = write_case(workdir, items, text)
+   try:
+      (expected, elapsed) = run(REFERENCE + [keyf, inf])
+      outputs = match_outputs(items, text, expected)
+   except RuntimeError as err:
+      return ['%s [reference]: %s' % (name, err)]
+   failures = []
+   for engine in MATCH_ENGINES:
+      for (mode, output) in outputs.items():
+         cmd = engine_cmd(binary, engine, keyf, inf)
+         try:
+            if run(cmd[:1] + [mode] + cmd[1:])[0] != output:
+               failures.append('%s [%s %s]: output differs from '
+                     'reference' % (name, engine, mode))
+         except RuntimeError as err:
+            failures.append('%s [%s %s]: %s' % (name, engine, mode, err))
+   return failures
+
+
+IUPAC = {'A': 'A', 'C': 'C', 'G': 'G', 'T': 'T', 'U': 'T',
+   'R': 'AG', 'Y': 'CT', 'S': 'CG', 'W': 'AT', 'K': 'GT', 'M': 'AC',
+   'B': 'CGT', 'D': 'AGT', 'H': 'ACT', 'V': 'ACG', 'N': 'ACGT'}
+
+# Configurations checked with '--iupac'.
+IUPAC_ENGINES = {
+   'iupac':          ['--iupac'],
+   'iupac-threads':  ['--iupac', '--threads', '4'],
+}
+
+
+def iupac_rank(c):
+   """Sort key of a key letter: the most specific first, then by
+   character."""
+   return (len(IUPAC.get(c, c)), ord(c))
+
+
+def reference_iupac(items, text):
+   """Replace the degenerate keys in 'text': the longest key at every
+   position, and between keys of the same length the one with the most
+   specific letter at the first position where they differ."""
+   keys = sorted((key for (key, value) in items if key),
+         key=lambda key: (-len(key), [iupac_rank(c) for c in key]))
+   values = dict(items)
+   out = []
+   i = 0
+   while i < len(text):
+      for key in keys:
+         if i + len(key) <= len(text) and all(c in IUPAC.get(k, k)
+               for (k, c) in zip(key, text[i:])):
+            out.append(values[key])
+            i += len(key)
+            break
+      else:
+         out.append(text[i])
+         i += 1
+   return ''.join(out).encode()
+
+
+def iupac_case(rng):
+   """Random degenerate keys (a few of them with the same bases and
+   different codes, to exercise ties) and a random input."""
+   bases = rng.choice(['ACGT', 'ACGTN', 'ACGTa'])
+   codes = rng.choice(['ACGTN', 'ACGTRYN', ''.join(IUPAC) + 'x'])
+   keys = set()
+   for i in range(rng.randint(1, 30)):
+      key = [rng.choice(codes) for j in range(rng.randint(1, 6))]
+      keys.add(''.join(key))
+      # Same key with one letter made less specific.
+      j = rng.randrange(len(key))
+      key[j] = rng.choice([c for c in IUPAC if key[j] in IUPAC[c]] or 'N')
+      keys.add(''.join(key))
+   items = [(key, '<%s>' % key) for key in sorted(keys)]
+   text = ''.join(rng.choice(bases + '\n') for i in range(rng.randint(0,
+         2000)))
+   return (items, text)
+
+
+def iupac(binary, workdir, name, items, text, expected=None):
+   """Compare '--iupac' with the reference (and with 'expected' if it
+   is given). Return failure messages."""
+   (keyf, inf) = write_case(workdir, items, text)
+   reference = reference_iupac(items, text)
+   if expected is not None and reference != expected:
+      return ['%s [reference]: output differs from expected' % name]
+   return compare(binary, name, IUPAC_ENGINES, [keyf, inf], reference)
+
+
+# Configurations checked with two key files ('-k first -k second').
+PASS_ENGINES = {
+   'passes':            [],
+   'passes-threads':    ['--threads', '4'],
+   'passes-streaming':  ['--line-buffered'],
+}
+
+
+def passes(binary, workdir, name, first, second, text):
+   """Compare '-k first -k second' with the pipeline of two calls, one
+   per key file. Return failure messages."""
+   (keyf, inf) = write_case(workdir, first, text)
+   firstf = os.path.join(workdir, 'first.txt')
+   os.replace(keyf, firstf)
+   midf = os.path.join(workdir, 'mid.txt')
+   try:
+      with open(midf, 'wb') as f:
+         f.write(run([binary, firstf, inf])[0])
+      (keyf, inf) = write_case(workdir, second, text)
+      (expected, elapsed) = run([binary, keyf, midf])
+   except RuntimeError as err:
+      return ['%s [pipeline]: %s' % (name, err)]
+   return compare(binary, name, PASS_ENGINES,
+         ['-k', firstf, '-k', keyf, inf], expected, against='pipeline')
+
+
+# Configurations checked with '--mismatches', '{d}' is replaced by the
+# number of mismatches.
+MISMATCH_ENGINES = {
+   'mismatches':          ['--mismatches', '{d}'],
+   'mismatches-threads':  ['--mismatches', '{d}', '--threads', '4'],
+}
+
+
+def reference_hamming(items, text, d):
+   """Replace the keys that match 'text' with at most 'd' substitutions
+   (never of a newline): the fewest mismatches win, then the longest
+   key. Keys tied on both are ambiguous and nothing matches."""
+   values = dict(item for item in items if item[0])
+   out = []
+   i = 0
+   while i < len(text):
+      hits = []
+      for key in values:
+         window = text[i:i+len(key)]
+         if len(window) < len(key) or '\n' in window:
+            continue
+         dist = sum(k != c for (k, c) in zip(key, window))
+         if dist <= d:
+            hits.append((dist, -len(key), key))
+      hits.sort()
+      if hits and (len(hits) == 1 or hits[0][:2] != hits[1][:2]):
+         out.append(values[hits[0][2]])
+         i += len(hits[0][2])
+      else:
+         out.append(text[i])
+         i += 1
+   return ''.join(out).encode()
+
+
+def hamming_case(rng, d):
+   """Random keys for 'd' mismatches: some key sets have keys of at most
+   'd' characters or too many lengths to be indexed, and the others are
+   searched with the index except near the end of the buffers."""
+   kind = rng.choice(['indexed', 'short', 'lengths'])
+   lengths = {'indexed': (d+1, 10), 'short': (1, 6),
+         'lengths': (d+1, 40)}[kind]
+   keys = set()
+   for i in range(rng.randint(1, 40 if kind == 'lengths' else 15)):
+      keys.add(''.join(rng.choice('acgt') for j in
+            range(rng.randint(*lengths))))
+   if kind == 'short':
+      keys.add(''.join(rng.choice('acgt') for j in range(rng.randint(1, d))))
+   items = [(key, '<%s>' % key) for key in sorted(keys)]
+   text = ''.join(rng.choice('acgt' * 8 + '\n') for i in
+         range(rng.randint(0, 2000)))
+   return (items, text)
+
+
+def hamming(binary, workdir, name, items, text, d, expected=None):
+   """Compare '--mismatches d' with the reference (and with 'expected'
+   if it is given). Return failure messages."""
+   (keyf, inf) = write_case(workdir, items, text)
+   reference = reference_hamming(items, text, d)
+   if expected is not None and reference != expected:
+      return ['%s [reference]: output differs from expected' % name]
+   return compare(binary, name, MISMATCH_ENGINES, [keyf, inf], reference,
+         d=d)
+
+
+def trickle(binary, workdir, name, items, text, rng):
+   """Feed the input to '--line-buffered' through a pipe in pieces of a
+   few bytes, one write at a time, so that reads end in the middle of
+   keys and the held prefixes are carried over to the next read.
+   Return failure messages."""
+   (keyf, inf) = write_case(workdir, items, text)
+   (expected, elapsed) = run(REFERENCE + [keyf, inf])
+   proc = subprocess.Popen([binary, '--line-buffered', keyf],
+         stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+         stderr=subprocess.DEVNULL)
+   output = []
+   reader = threading.Thread(target=lambda: output.append(proc.stdout.read()))
+   reader.start()
+   data = text.encode()
+   i = 0
+   while i < len(data):
+      n = rng.randint(1, 8)
+      os.write(proc.stdin.fileno(), data[i:i+n])
+      i += n
+      time.sleep(0.0002)
+   proc.stdin.close()
+   reader.join()
+   if proc.wait() != 0:
+      return ['%s [trickle]: exit status %d' % (name, proc.returncode)]
+   if output[0] != expected:
+      return ['%s [trickle]: output differs from reference' % name]
+   return []
+
+
+# Engines checked with a prompt (input that stays open, no newline).
+PROMPT_ENGINES = {
+   'prompt-trie':  ['--engine', 'trie'],
+   'prompt-hash':  ['--engine', 'hash'],
+   'prompt-skip':  ['--engine', 'skip'],
+}
+
+
+def prompt(binary, workdir, name, items, text, held):
+   """Write 'text' to '--line-buffered' through a pipe that stays open:
+   the output of all but the last 'held' characters, which may start a
+   key, must come out before the input ends. Return failure
+   messages."""
+   (keyf, inf) = write_case(workdir, items, text[:len(text)-held])
+   (early, elapsed) = run(REFERENCE + [keyf, inf])
+   (keyf, inf) = write_case(workdir, items, text)
+   (expected, elapsed) = run(REFERENCE + [keyf, inf])
+   failures = []
+   for (engine, args) in PROMPT_ENGINES.items():
+      proc = subprocess.Popen([binary, '--line-buffered'] + args + [keyf],
+            stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL)
+      os.write(proc.stdin.fileno(), text.encode())
+      output = b''
+      deadline = time.time() + 5
+      while len(output) < len(early) and time.time() < deadline:
+         if select.select([proc.stdout], [], [], 0.1)[0]:
+            output += os.read(proc.stdout.fileno(), 65536)
+      # Nothing more should come out until the input ends.
+      if select.select([proc.stdout], [], [], 0.2)[0]:
+         output += os.read(proc.stdout.fileno(), 65536)
+      proc.stdin.close()
+      rest = proc.stdout.read()
+      proc.wait()
+      if output != early:
+         failures.append('%s [%s]: %r came out before the end of the '
+               'input instead of %r' % (name, engine, output, early))
+      elif output + rest != expected:
+         failures.append('%s [%s]: output differs from reference'
+               % (name, engine))
+   return failures
+
+
+def stale_profile(binary, workdir, name, old_items, items, text):
+   """Save a profile with the key set 'old_items' and load it with the
+   key set 'items'. Nodes of the profile may not exist anymore, or be
+   hot under nodes that are cold. Return failure messages."""
+   profile = os.path.join(workdir, 'profile.txt')
+   (keyf, inf) = write_case(workdir, old_items, text)
+   try:
+      run([binary, '--train', inf, '--profile', profile, keyf, inf])
+      (keyf, inf) = write_case(workdir, items, text)
+      (expected, elapsed) = run(REFERENCE + [keyf, inf])
+      (output, elapsed) = run([binary, '--profile', profile, keyf, inf])
+   except RuntimeError as err:
+      return ['%s [stale profile]: %s' % (name, err)]
+   if output != expected:
+      return ['%s [stale profile]: output differs from reference' % name]
+   return []
+
+
+def growth(binary, workdir, engine, items, unit, sizes, repeat):
+   """Return the growth of the cost per byte from the first sizes to the
+   others and the last cost per byte. Every size is timed 'repeat' times
+   and the median is kept. Startup costs cancel out by timing the
+   differences between consecutive sizes."""
+   times = []
+   for size in sizes:
+      text = (unit * (size // len(unit) + 1))[:size]
+      (keyf, inf) = write_case(workdir, items, text)
+      cmd = engine_cmd(binary, engine, keyf, inf)
+      times.append(sorted(run(cmd)[1] for i in range(repeat))[repeat // 2])
+   slopes = [max(t2 - t1, 1e-4) / (s2 - s1) for (s1, s2, t1, t2) in
+         zip(sizes, sizes[1:], times, times[1:])]
+   return (max(slopes) / slopes[0], slopes[-1])
+
+
+def scaling(binary, workdir, name, items, unit, sizes, bound, repeat):
+   """Time the engines on inputs of growing size. An engine over the
+   bound is timed again and fails only if it is over the bound twice,
+   so that a burst of load on the machine does not fail the case."""
+   failures = []
+   for engine in ENGINES:
+      (ratio, slope) = growth(binary, workdir, engine, items, unit,
+            sizes, repeat)
+      if ratio > bound:
+         (ratio, slope) = min((ratio, slope), growth(binary, workdir,
+               engine, items, unit, sizes, repeat))
+      sys.stderr.write('%-14s %-9s %8.1f ns/byte  growth %.2f\n' %
+            (name, engine, 1e9 * slope, ratio))
+      if ratio > bound:
+         failures.append('%s [%s]: cost per byte grew %.2f times '
+               '(bound %.2f)' % (name, engine, ratio, bound))
+   return failures
+
+
+def main():
+   parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+   parser.add_argument('--binary', default=os.path.join(ROOT, 'radixtrie'))
+   parser.add_argument('--seed', type=int, default=1)
+   parser.add_argument('--fuzz', type=int, default=200,
+         help='number of random cases')
+   parser.add_argument('--depth', type=int, default=64,
+         help='key length of the pathological cases')
+   parser.add_argument('--bound', type=float, default=2.5,
+         help='maximal growth of the cost per byte')
+   parser.add_argument('--sizes', default='1000000,4000000,16000000',
+         help='input sizes for the scaling test')
+   parser.add_argument('--repeat', type=int, default=5,
+         help='timings per size (the median is kept)')
+   parser.add_argument('--timing', action='store_true',
+         help='also time the pathological cases')
+   args = parser.parse_args()
+
+   rng = random.Random(args.seed)
+   sizes = [int(s) for s in args.sizes.split(',')]
+   workdir = tempfile.mkdtemp(prefix='whiplace-')
+   failures = []
+   try:
+      for (name, items, unit) in pathological_cases(args.depth):
+         text = (unit * (5000 // len(unit)) + '\n') * 3
+         failures += differential(args.binary, workdir, name, items, text)
+         failures += match_only(args.binary, workdir, name, items, text)
+         if args.timing:
+            failures += scaling(args.binary, workdir, name, items, unit,
+                  sizes, args.bound, args.repeat)
+      failures += stale_profile(args.binary, workdir, 'split-node',
+            [('abc', 'X')], [('abc', 'X'), ('abd', 'Y'), ('b', 'Z')],
+            'abcabdxx\nabd\nbb\n' * 50)
+      # Keys with a long common prefix, split after it when sharded.
+      keys = ['https://www.example.com/' + k for k in
+            ['', 'a', 'ab', 'abc', 'b/c', 'b/d', 'ba', 'c' * 20, 'd']]
+      failures += differential(args.binary, workdir, 'common-prefix',
+            [(k, '<%d>' % i) for (i, k) in enumerate(keys)],
+            ''.join(k + ' ' + k[:-1] + '\n' for k in keys) * 20)
+      # No key starts in 'fine', the end of the prompt is not held.
+      prompt_items = [('abcdefghij', '1'), ('acegikmoqs', '2'),
+            ('azzzzzzzzz', '3')]
+      failures += prompt(args.binary, workdir, 'prompt',
+            prompt_items, 'status: everything fine', 0)
+      failures += prompt(args.binary, workdir, 'prompt-prefix',
+            prompt_items, 'abcdefghij: everything fine abcd', 4)
+      # Ties between keys of the same length: the most specific letter
+      # at the first difference wins, whatever the letters after it.
+      failures += iupac(args.binary, workdir, 'iupac-ties',
+            [('ACGTA', 'a'), ('ACGTR', 'r'), ('ACGTN', 'n'), ('ANA', '1'),
+               ('NAA', '2'), ('RC', '3'), ('AN', '4')],
+            'ACGTAACGTGACGTC\nAAA\nAC\nGC\n',
+            b'arn\n1\n4\n3\n')
+      # 'aac' and 'aag' are both one mismatch away from 'aat': the hit
+      # is ambiguous, with the index and without it (the key 't' has
+      # at most one character).
+      for (name, extra, expected) in [('indexed', [], b'aat\n<aac>\n'),
+            ('fallback', [('t', '<t>')], b'a<t><t>\n<aac>\n')]:
+         failures += hamming(args.binary, workdir, 'ambiguous-' + name,
+               [('aac', '<aac>'), ('aag', '<aag>')] + extra, 'aat\naac\n',
+               1, expected)
+      old_items = []
+      for i in range(args.fuzz):
+         (items, text) = fuzz_case(rng)
+         failures += differential(args.binary, workdir,
+               'fuzz-%d' % i, items, text)
+         failures += match_only(args.binary, workdir,
+               'fuzz-%d' % i, items, text)
+         if i % 5 == 0:
+            failures += trickle(args.binary, workdir, 'fuzz-%d' % i,
+                  items, text, random.Random(i))
+         if old_items:
+            failures += stale_profile(args.binary, workdir,
+                  'fuzz-%d' % i, old_items, items, text)
+            failures += passes(args.binary, workdir, 'fuzz-%d' % i,
+                  old_items, items, text)
+         old_items = items
+         for d in (1, 2):
+            (items, text) = hamming_case(rng, d)
+            failures += hamming(args.binary, workdir,
+                  'hamming-%d-%d' % (d, i), items, text, d)
+         (items, text) = iupac_case(rng)
+         failures += iupac(args.binary, workdir, 'iupac-%d' % i, items,
+               text)
+   finally:
+      shutil.rmtree(workdir)
+
+   for failure in failures:
+      sys.stderr.write('FAIL %s\n' % failure)
+   sys.stderr.write('%d failure(s)\n' % len(failures))
+   return 1 if failures else 0
+
+
+if __name__ == '__main__':
+   sys.exit(main())
@@ -0,0 +1,154 @@
+#!/usr/bin/env python
+# -*- coding:utf-8 -*-
+
+"""Tests of the Python binding 'whiplace.so'.
+
+The results of 'Trie.replace_many()' are compared to 'whiplace.py',
+which is the reference, with one thread and with several. The misuses
+of the binding (non-str items, trie not initialized, re-initialization
+while a batch runs, '\0' in keys) must raise an exception, and a
+rejected key set must leave the trie as it was.
+
+Invoke as 'python3 tests/binding.py' from the repository root, after
+'make whiplace.so'. The exit status is 1 if any test fails."""
+
+import importlib.machinery
+import importlib.util
+import os
+import random
+import sys
+import threading
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+
+
+def load(name, path, loader=None):
+   spec = importlib.util.spec_from_file_location(name, path, loader=loader)
+   module = importlib.util.module_from_spec(spec)
+   spec.loader.exec_module(module)
+   return module
+
+
+# Both are called 'whiplace': load them from their files.
+so = os.path.join(ROOT, 'whiplace.so')
+whiplace = load('whiplace', so,
+      importlib.machinery.ExtensionFileLoader('whiplace', so))
+reference = load('whiplace_ref', os.path.join(ROOT, 'whiplace.py'))
+
+
+def replace(trie, s):
+   """Replace the keys in 's' like 'whiplace.py' does."""
+   out = []
+   while s:
+      (suffix, node, tail, rest) = trie.key_path(s, trie.root)
+      if tail is not None:
+         out.append(tail.data)
+         s = rest
+      else:
+         out.append(s[0])
+         s = s[1:]
+   return ''.join(out)
+
+
+failures = []
+
+def check(name, cond):
+   if not cond:
+      failures.append(name)
+      sys.stdout.write('FAIL %s\n' % name)
+
+
+def raises(exc, f, *args, **kwds):
+   try:
+      f(*args, **kwds)
+   except exc:
+      return True
+   return False
+
+
+def test_differential(rng):
+   for case in range(50):
+      alphabet = 'abc'[:rng.randint(1, 3)] + 'é'
+      keys = {''.join(rng.choice(alphabet)
+            for _ in range(rng.randint(1, 5))) for _ in range(10)}
+      items = [(k, rng.choice(['', 'X', 'YY', 'Zé'])) for k in keys]
+      strings = [''.join(rng.choice(alphabet)
+            for _ in range(rng.randint(0, 40))) for _ in range(200)]
+      trie = whiplace.Trie([k for k, v in items], [v for k, v in items])
+      ref = reference.RadixTrie.from_items(items)
+      expected = [replace(ref, s) for s in strings]
+      for threads in (1, 4):
+         check('differential %d threads=%d' % (case, threads),
+               trie.replace_many(strings, threads=threads) == expected)
+
+
+def test_order_and_passthrough():
+   trie = whiplace.Trie(['ab', 'b'], ['X', 'Y'])
+   strings = ['zzz%d' % i if i % 3 else 'ab%d' % i for i in range(1000)]
+   result = trie.replace_many(strings, threads=8)
+   check('order', result == [s.replace('ab', 'X') for s in strings])
+   # Strings with no match are returned as they are.
+   check('passthrough', all(r is s for r, s in zip(result, strings)
+         if 'ab' not in s))
+   check('empty batch', trie.replace_many([], threads=4) == [])
+
+
+def test_errors():
+   trie = whiplace.Trie(['a'], ['b'])
+   check('non-str item', raises(TypeError, trie.replace_many, ['a', 1]))
+   check('non-sequence', raises(TypeError, trie.replace_many, 1))
+   check('duplicated key', raises(ValueError, whiplace.Trie, ['a', 'a'],
+         ['b', 'c']))
+   check('length mismatch', raises(ValueError, whiplace.Trie, ['a'], []))
+   check('NUL in key', raises(ValueError, whiplace.Trie, ['a\x00b'],
+         ['Z']))
+   check('NUL in value', raises(ValueError, whiplace.Trie, ['a'],
+         ['Z\x00']))
+   # A rejected key set leaves the trie as it was.
+   for (keys, values) in [(['x', 'x'], ['1', '2']), (['x'], []),
+         (['x', 'a\x00'], ['1', '2'])]:
+      check('failed re-init %r' % keys,
+            raises(ValueError, trie.__init__, keys, values) and
+            trie.replace_many(['x a é']) == ['x b é'])
+   uninit = whiplace.Trie.__new__(whiplace.Trie)
+   check('not initialized', raises(RuntimeError, uninit.replace_many,
+         ['a']))
+
+
+def test_reinit_while_busy():
+   """Re-initializing the trie while another thread is in
+   'replace_many()' must be refused, not free the trie under it."""
+   trie = whiplace.Trie(['a' * i for i in range(1, 50)],
+         [str(i) for i in range(1, 50)])
+   strings = ['a' * 200] * 20000
+   expected = trie.replace_many(strings[:1])[0]
+   results = []
+   worker = threading.Thread(target=lambda:
+         results.append(trie.replace_many(strings, threads=2)))
+   worker.start()
+   refused = 0
+   while worker.is_alive():
+      try:
+         trie.__init__(['a' * i for i in range(1, 50)],
+               [str(i) for i in range(1, 50)])
+      except RuntimeError:
+         refused += 1
+   worker.join()
+   check('re-init while busy', results and
+         all(r == expected for r in results[0]))
+   sys.stdout.write('re-init refused %d time(s)\n' % refused)
+
+
+def main():
+   rng = random.Random(1)
+   test_differential(rng)
+   test_order_and_passthrough()
+   test_errors()
+   test_reinit_while_busy()
+   sys.stdout.write('%d failure(s)\n' % len(failures))
+   return 1 if failures else 0
+
+
+if __name__ == '__main__':
+   sys.exit(main())
@@ -32,13 +32,16 @@ class RadixTrieNode(object):
       self.data = data
       self.children = []
 
-   def fork(node):
+   def fork(self, node):
       """A method for readability. Use 'fork' to add a node that
       shares a prefix with current node to the trie."""
       (pref, suff_1, suff_2) = commonprefix(self.subkey, node.subkey)
       node.subkey = suff_2
       self.subkey = pref
-      self.children = [RadixTrieNode(suff_1, self.data), node]
+      # The current node keeps its data and children below the fork.
+      below = RadixTrieNode(suff_1, self.data)
+      below.children = self.children
+      self.children = [below, node]
       self.data = None
 
 
@@ -51,21 +54,22 @@ class RadixTrie(object):
       """Radix tries are instantiated with an empty 'root' node."""
       self.root = RadixTrieNode()
 
-   def key_path(self, key, node, tail=None):
-      """Recursive search for key path. Return a 3-tuple with:
+   def key_path(self, key, node, tail=None, rest=None):
+      """Recursive search for key path. Return a 4-tuple with:
           'key' : the unmatched suffix
           'node': the deepest node matching initial 'key' prefix
-          'tail': the deepest tail matching initial 'key' prefix"""
+          'tail': the deepest tail matching initial 'key' prefix
+          'rest': the unmatched suffix after 'tail'"""
       for child in node.children:
          if not key.startswith(child.subkey): continue
          key = key[len(child.subkey):]
-         if child.data is not None: tail = child
-         return self.key_path(key, child, tail)
-      return (key, node, tail)
+         if child.data is not None: (tail, rest) = (child, key)
+         return self.key_path(key, child, tail, rest)
+      return (key, node, tail, rest)
 
    def add(self, key, data):
       """Add a key/data pair to the radix trie."""
-      (suf, node, tail) = self.key_path(key, self.root)
+      (suf, node, tail, rest) = self.key_path(key, self.root)
       new_node = RadixTrieNode(suf, data)
       try:
          k = [child.subkey[0] for child in node.children].index(suf[0])
@@ -113,9 +117,11 @@ if __name__ == '__main__':
    # Read key/data pairs from key file, one per line. This assumes
    # that '\n' is not a key character. This assumption will be reused
    # when reading the stream line by line.
-   # The key/data pairs are split on the tab character '\t'.
+   # The key/data pairs are split on the first tab character '\t',
+   # and lines with no key are ignored.
    with open(key_fname) as f:
-      items = [l.rstrip().split('\t') for l in f]
+      items = [l.rstrip('\n').split('\t', 1) for l in f]
+      items = [item for item in items if item[0]]
       try:
          trie = RadixTrie.from_items(items)
       except KeyDuplicated as key:
@@ -125,10 +131,10 @@ if __name__ == '__main__':
    with inputf as f:
       for key in f:
          while key:
-            (suffix, node, tail) = trie.key_path(key, trie.root)
+            (suffix, node, tail, rest) = trie.key_path(key, trie.root)
             if tail is not None:
                sys.stdout.write(tail.data)
-               key = suffix
+               key = rest
             else:
                sys.stdout.write(key[0])
                key = key[1:]
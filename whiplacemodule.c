@@ -1,42 +1,371 @@
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "radixtrie.h"
+
+#define MAX_THREADS 64
+
+/* Trie object: a compiled key set. The tail nodes point to the
+   values in 'pool'. 'busy' counts the calls of 'replace_many()' that
+   use the trie with the GIL released. */
+typedef struct {
+   PyObject_HEAD
+   rt_node *root;
+   char    *pool;
+   int      busy;
+}
+TrieObject;
+
+/* Slice of a batch processed by one thread. */
+typedef struct {
+   rt_node      *root;
+   const char  **in;
+   Py_ssize_t   *inlen;
+   char        **out;
+   size_t       *outlen;
+   Py_ssize_t    start;
+   Py_ssize_t    end;
+   int           failed;
+}
+batch;
+
+
+static char *
+replace_one(const char *s, size_t len, rt_node *root, size_t *outlen)
+{
+/*
+ * Return a malloc'd copy of 's' with the keys replaced, or
+ * NULL if 's' contains no key (or upon memory failure, in
+ * which case 'outlen' is set to -1).
+ */
+
+   size_t i = 0, run = 0, size = 0, match_len, vlen;
+   char *out = NULL, *tmp;
+   rt_node *match;
+
+   *outlen = 0;
+
+   while (i < len) {
+      match = rt_match_buf(s + i, len - i, root, &match_len, NULL);
+      if (match == NULL) {
+         i++;
+         continue;
+      }
+      vlen = strlen(match->data);
+      if (*outlen + (i - run) + vlen + (len - i) > size) {
+         size = 2 * (*outlen + (i - run) + vlen + (len - i));
+         if ((tmp = realloc(out, size)) == NULL) goto fail;
+         out = tmp;
+      }
+      memcpy(out + *outlen, s + run, i - run);
+      *outlen += i - run;
+      memcpy(out + *outlen, match->data, vlen);
+      *outlen += vlen;
+      i += match_len;
+      run = i;
+   }
+
+   if (out != NULL) {
+      /* Room for the tail was reserved on the last match. */
+      memcpy(out + *outlen, s + run, len - run);
+      *outlen += len - run;
+   }
+
+   return out;
+
+fail:
+   free(out);
+   *outlen = (size_t) -1;
+   return NULL;
+
+}
+
+
+static void *
+replace_batch(void *arg)
+{
+/* Thread body: replace every string of the slice. */
+
+   batch *b = (batch *) arg;
+   Py_ssize_t i;
+
+   for (i = b->start ; i < b->end ; i++) {
+      b->out[i] = replace_one(b->in[i], b->inlen[i], b->root,
+            b->outlen + i);
+      if (b->outlen[i] == (size_t) -1) b->failed = 1;
+   }
+
+   return NULL;
+
+}
+
+
+static int
+Trie_init(TrieObject *self, PyObject *args, PyObject *kwds)
+{
+
+   PyObject *keys, *values;
+   Py_ssize_t i, n;
+   size_t match_len;
+
+   if (!PyArg_ParseTuple(args, "OO", &keys, &values)) return -1;
+
+   /* Other threads may be walking the trie. */
+   if (self->busy) {
+      PyErr_SetString(PyExc_RuntimeError,
+            "cannot re-initialize a Trie while replace_many() runs");
+      return -1;
+   }
+
+   keys = PySequence_Fast(keys, "keys must be a sequence");
+   if (keys == NULL) return -1;
+   values = PySequence_Fast(values, "values must be a sequence");
+   if (values == NULL) {
+      Py_DECREF(keys);
+      return -1;
+   }
+
+   /* Build the new trie aside, so that the old one stays usable if
+      the new key set is rejected. */
+   rt_node *root = NULL;
+   char *pool = NULL;
+
+   n = PySequence_Fast_GET_SIZE(keys);
+   if (PySequence_Fast_GET_SIZE(values) != n) {
+      PyErr_SetString(PyExc_ValueError,
+            "keys and values must have the same length");
+      goto fail;
+   }
+
+   /* Copy the values in one block: the strings may be freed. */
+   Py_ssize_t size, keysize, pos = 0;
+   for (i = 0 ; i < n ; i++) {
+      if (PyUnicode_AsUTF8AndSize(PySequence_Fast_GET_ITEM(values, i),
+               &size) == NULL) goto fail;
+      pos += size + 1;
+   }
+   if ((pool = PyMem_Malloc(pos + 1)) == NULL) {
+      PyErr_NoMemory();
+      goto fail;
+   }
+
+   root = create_orphan_node("", NULL);
+
+   for (pos = 0, i = 0 ; i < n ; i++) {
+      const char *key = PyUnicode_AsUTF8AndSize(
+            PySequence_Fast_GET_ITEM(keys, i), &keysize);
+      const char *value = PyUnicode_AsUTF8AndSize(
+            PySequence_Fast_GET_ITEM(values, i), &size);
+      if (key == NULL || value == NULL) goto fail;
+      /* The trie holds NUL-terminated strings. */
+      if (strlen(key) != (size_t) keysize ||
+            strlen(value) != (size_t) size) {
+         PyErr_SetString(PyExc_ValueError,
+               "keys and values cannot contain '\\0'");
+         goto fail;
+      }
+      char *copy = memcpy(pool + pos, value, size + 1);
+      pos += size + 1;
+      /* Keys with no character are ignored. */
+      if (key[0] == '\0') continue;
+      rt_node *node = rt_match_buf(key, keysize, root, &match_len, NULL);
+      if (node != NULL && match_len == (size_t) keysize) {
+         PyErr_Format(PyExc_ValueError, "key '%s' is duplicated", key);
+         goto fail;
+      }
+      add_key(root, (char *) key, copy, i);
+   }
+
+   if (self->root != NULL) rt_free(self->root);
+   PyMem_Free(self->pool);
+   self->root = root;
+   self->pool = pool;
+
+   Py_DECREF(keys);
+   Py_DECREF(values);
+   return 0;
+
+fail:
+   if (root != NULL) rt_free(root);
+   PyMem_Free(pool);
+   Py_DECREF(keys);
+   Py_DECREF(values);
+   return -1;
+
+}
+
+
+static void
+Trie_dealloc(TrieObject *self)
+{
+   if (self->root != NULL) rt_free(self->root);
+   PyMem_Free(self->pool);
+   Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
 
-/* whiplace module function */
 static PyObject *
-whiplace(PyObject *self, PyObject *args)
+Trie_replace_many(TrieObject *self, PyObject *args, PyObject *kwds)
 {
 
-   char *fname;
-   FILE *f;
+   static char *kwlist[] = {"strings", "threads", NULL};
+   PyObject *strings, *seq, *result = NULL;
+   int nthreads = 0;
+   Py_ssize_t i, n;
 
-   PyTupleObject *keyTuple
-   PyTupleObject *valueTuple
+   if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist,
+            &strings, &nthreads)) {
+      return NULL;
+   }
+
+   if (self->root == NULL) {
+      PyErr_SetString(PyExc_RuntimeError, "Trie is not initialized");
+      return NULL;
+   }
+
+   seq = PySequence_Fast(strings, "argument must be a sequence");
+   if (seq == NULL) return NULL;
+   n = PySequence_Fast_GET_SIZE(seq);
+
+   /* Hold the items: 'seq' may be a list modified by other threads. */
+   PyObject **items = PyMem_Calloc(n + 1, sizeof(PyObject *));
+   const char **in = PyMem_Calloc(n + 1, sizeof(char *));
+   Py_ssize_t *inlen = PyMem_Calloc(n + 1, sizeof(Py_ssize_t));
+   char **out = PyMem_Calloc(n + 1, sizeof(char *));
+   size_t *outlen = PyMem_Calloc(n + 1, sizeof(size_t));
+   if (!items || !in || !inlen || !out || !outlen) {
+      PyErr_NoMemory();
+      goto done;
+   }
 
-   if (! PyArg_ParseTuple(args, "OOs", &keyTuple, &valueTuple,
-            &fname)) {
-       return NULL;
+   for (i = 0 ; i < n ; i++) {
+      items[i] = PySequence_Fast_GET_ITEM(seq, i);
+      Py_INCREF(items[i]);
+      in[i] = PyUnicode_AsUTF8AndSize(items[i], inlen + i);
+      if (in[i] == NULL) goto done;
    }
-   else {
-      f = PySys_GetFile(fname, stdin);
-      /* Format the tuples to arrays */
-      int nkeys = PyTuple_Size(keyArray);
-      if (PyTuple_Size(valueArray) != nkeys) {
-         return NULL;
+
+   if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   if (nthreads > MAX_THREADS) nthreads = MAX_THREADS;
+   if (nthreads > n) nthreads = n;
+   if (nthreads < 1) nthreads = 1;
+
+   batch batches[MAX_THREADS];
+   pthread_t threads[MAX_THREADS];
+   int t, started = 0, failed = 0;
+
+   for (t = 0 ; t < nthreads ; t++) {
+      batches[t] = (batch) {
+         .root = self->root, .in = in, .inlen = inlen,
+         .out = out, .outlen = outlen,
+         .start = n * t / nthreads, .end = n * (t+1) / nthreads,
+         .failed = 0,
+      };
+   }
+
+   /* The trie is read-only, so the threads need no lock. */
+   self->busy++;
+   Py_BEGIN_ALLOW_THREADS
+   for (t = 1 ; t < nthreads ; t++) {
+      if (pthread_create(threads + t, NULL, replace_batch, batches + t))
+         break;
+      started = t;
+   }
+   replace_batch(batches);
+   /* Run the slices that could not get a thread here. */
+   for (t = started + 1 ; t < nthreads ; t++) replace_batch(batches + t);
+   for (t = 1 ; t <= started ; t++) pthread_join(threads[t], NULL);
+   Py_END_ALLOW_THREADS
+   self->busy--;
+
+   for (t = 0 ; t < nthreads ; t++) failed |= batches[t].failed;
+   if (failed) {
+      PyErr_NoMemory();
+      goto done;
+   }
+
+   /* Build the list in the original order. */
+   if ((result = PyList_New(n)) == NULL) goto done;
+   for (i = 0 ; i < n ; i++) {
+      PyObject *s;
+      if (out[i] == NULL) {
+         /* No match: return the original string. */
+         Py_INCREF(items[i]);
+         s = items[i];
       }
+      else {
+         s = PyUnicode_DecodeUTF8(out[i], outlen[i], "strict");
+         if (s == NULL) {
+            Py_CLEAR(result);
+            goto done;
+         }
+      }
+      PyList_SET_ITEM(result, i, s);
+   }
 
-      char *keyArray[], *valueArray[]; // <<<<<<<< DYNAMIC ALLOCATION
-      /* FILE *PySys_GetFile(char *name, FILE *def) */
+done:
+   for (i = 0 ; i < n ; i++) {
+      if (items != NULL) Py_XDECREF(items[i]);
+      if (out != NULL) free(out[i]);
    }
+   PyMem_Free(items);
+   PyMem_Free(in);
+   PyMem_Free(inlen);
+   PyMem_Free(out);
+   PyMem_Free(outlen);
+   Py_DECREF(seq);
+   return result;
 
 }
 
-/* registration table */
-static PyMethodDef whiplace_methods[] = {
-   {"whiplace", whiplace, METH_VARARGS,
-      "Fast string replacement."},
+
+static PyMethodDef Trie_methods[] = {
+   {"replace_many", (PyCFunction) Trie_replace_many,
+      METH_VARARGS | METH_KEYWORDS,
+      "replace_many(strings, threads=0)\n\n"
+      "Replace the keys in every string of the sequence and return\n"
+      "the list of results in the same order. The batch is split\n"
+      "between 'threads' native threads (0 for one per CPU) and the\n"
+      "GIL is released during the replacement."},
    {NULL, NULL, 0, NULL}
 };
 
+static PyTypeObject TrieType = {
+   PyVarObject_HEAD_INIT(NULL, 0)
+   .tp_name = "whiplace.Trie",
+   .tp_doc = "Trie(keys, values): compiled key set for replacement.",
+   .tp_basicsize = sizeof(TrieObject),
+   .tp_flags = Py_TPFLAGS_DEFAULT,
+   .tp_new = PyType_GenericNew,
+   .tp_init = (initproc) Trie_init,
+   .tp_dealloc = (destructor) Trie_dealloc,
+   .tp_methods = Trie_methods,
+};
+
+/* module definition */
+static struct PyModuleDef whiplace_module = {
+   PyModuleDef_HEAD_INIT,
+   .m_name = "whiplace",
+   .m_doc = "Fast string replacement.",
+   .m_size = -1,
+};
+
 /* module initializer */
-void initwhiplace() {
-   Py_InitModule("whiplace", whiplace_methods);
+PyMODINIT_FUNC
+PyInit_whiplace(void)
+{
+   PyObject *m;
+
+   if (PyType_Ready(&TrieType) < 0) return NULL;
+   if ((m = PyModule_Create(&whiplace_module)) == NULL) return NULL;
+
+   Py_INCREF(&TrieType);
+   if (PyModule_AddObject(m, "Trie", (PyObject *) &TrieType) < 0) {
+      Py_DECREF(&TrieType);
+      Py_DECREF(m);
+      return NULL;
+   }
+
+   return m;
 }